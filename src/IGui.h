@@ -218,6 +218,20 @@ public:
      */
     virtual void onPresenceChanged(Id /*userid*/, Presence /*pres*/, bool /*inProgress*/) {}
 
+    /**
+     * @brief Called with the presence changes of peers coalesced during a period,
+     * when presence coalescing is enabled. By default, notifies them one by one.
+     *
+     * @param changes Latest presence of every peer whose presence has changed
+     */
+    virtual void onPresencesChanged(const std::map<Id, Presence>& changes)
+    {
+        for (auto& change: changes)
+        {
+            onPresenceChanged(change.first, change.second, false);
+        }
+    }
+
     /**
      * @brief Called when the presence preferences have changed due to
      * our or another client of our account updating them.
@@ -7,10 +7,90 @@
 #include "gcm.h"
 #include "logger.h"
 #include <memory>
+#include <atomic>
+#include <new>
+#include <cstddef>
+#include <stdint.h>
 #include <assert.h>
 
 namespace karere
 {
+/** Fixed-size pool for the messages of marshallCall(), so that calls with small captures
+ * don't hit the allocator. Nodes are taken by any thread and given back by the GUI thread,
+ * through a lock-free free list whose head is tagged to avoid the ABA problem. When the
+ * message doesn't fit in a node or the pool is exhausted, the heap is used instead.
+ */
+class MessagePool
+{
+public:
+    enum
+    {
+        kNodeSize = 128,
+        kNodeCount = 2048
+    };
+
+    static MessagePool& get()
+    {
+        // never destroyed, since messages may be released after static destructors have run
+        static MessagePool* sPool = new MessagePool();
+        return *sPool;
+    }
+
+    void* alloc(size_t size)
+    {
+        if (size <= kNodeSize)
+        {
+            uint64_t head = mHead.load(std::memory_order_acquire);
+            while ((uint32_t)head != kNone)
+            {
+                uint32_t idx = (uint32_t)head;
+                uint64_t next = (((head >> 32) + 1) << 32) | mNext[idx].load(std::memory_order_relaxed);
+                if (mHead.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+                {
+                    return mNodes + (size_t)idx * kNodeSize;
+                }
+            }
+        }
+        return ::operator new(size);
+    }
+
+    void release(void* ptr)
+    {
+        char* node = static_cast<char*>(ptr);
+        if (node < mNodes || node >= mNodes + (size_t)kNodeCount * kNodeSize)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+
+        uint32_t idx = (uint32_t)((node - mNodes) / kNodeSize);
+        uint64_t head = mHead.load(std::memory_order_relaxed);
+        uint64_t next;
+        do
+        {
+            mNext[idx].store((uint32_t)head, std::memory_order_relaxed);
+            next = (((head >> 32) + 1) << 32) | idx;
+        } while (!mHead.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+protected:
+    enum: uint32_t { kNone = 0xffffffff };
+
+    alignas(std::max_align_t) char mNodes[(size_t)kNodeCount * kNodeSize];
+    std::atomic<uint32_t> mNext[kNodeCount];
+    std::atomic<uint64_t> mHead;    // tag (high 32 bits) | index of the first free node
+
+    MessagePool()
+    {
+        static_assert(kNodeSize % alignof(std::max_align_t) == 0, "Misaligned MessagePool nodes");
+        for (uint32_t i = 0; i < kNodeCount; i++)
+        {
+            mNext[i].store((i + 1 < kNodeCount) ? i + 1 : kNone, std::memory_order_relaxed);
+        }
+        mHead.store(0, std::memory_order_relaxed);
+    }
+};
+
 /** This function uses the plain C Gui Call Marshaller mechanism (see gcm.h) to
  * marshal a C++11 lambda function call on the main (GUI) thread. Also it could
  * be used with a std::function or any other object with operator()). It provides
@@ -26,6 +106,8 @@ static inline void marshallCall(F&& func, void *appCtx)
         F mFunc;
         Msg(F&& aFunc, megaMessageFunc cHandler)
         : megaMessage(cHandler), mFunc(std::forward<F>(aFunc)){}
+        static void* operator new(size_t size) { return MessagePool::get().alloc(size); }
+        static void operator delete(void* ptr) { MessagePool::get().release(ptr); }
 #ifndef NDEBUG
         unsigned magic = 0x3e9a3591;
 #endif
@@ -3,13 +3,16 @@
 #endif
 
 #include <iostream>
+#include <algorithm>
 #include <stdarg.h>
 #include <string.h>
 #define KRLOGGER_BUILDING //sets DLLIMPEXPs in logger.h to 'export' mode
 #include "logger.h"
 #include "loggerFile.h"
 #include "loggerConsole.h"
+#include "loggerAsync.h"
 #include "../stringUtils.h" //needed for parsing the KRLOG env variable
+#include "../base64url.h"
 #include "sdkApi.h"
 
 #ifdef _WIN32
@@ -93,8 +96,26 @@ void Logger::setAutoFlush(bool enable)
         mFlags |= krLogNoAutoFlush;
 }
 
+void Logger::logAsync(bool enable, size_t queueSize)
+{
+    if (enable)
+    {
+        LockGuard lock(mMutex);
+        if (!mAsyncLogger)
+        {
+            mAsyncLogger.reset(new AsyncLogger(*this, queueSize));
+        }
+        mAsyncEnabled.store(true, std::memory_order_release);
+    }
+    else if (mAsyncEnabled.exchange(false))
+    {
+        // the writer thread is kept, in case other threads are still queueing records
+        mAsyncLogger->flush();
+    }
+}
+
 Logger::Logger(unsigned aFlags, const char* timeFmt)
-    :mTimeFmt(timeFmt), mFlags(aFlags)
+    :mTimeFmt(timeFmt), mAsyncEnabled(false), mFlags(aFlags)
 {
     setup();
     setupFromEnvVar();
@@ -103,13 +124,13 @@ Logger::Logger(unsigned aFlags, const char* timeFmt)
 }
 
 inline size_t Logger::prependInfo(char* buf, size_t bufSize, const char* prefix, const char* severity,
-                                  unsigned flags)
+                                  unsigned flags, time_t ts)
 {
     size_t bytesLogged = 0;
     if ((mFlags & krLogNoTimestamps) == 0)
     {
         buf[bytesLogged++] = '[';
-        time_t now = time(NULL);
+        time_t now = ts ? ts : time(NULL);
         struct tm tmbuf;
         struct tm* tmval = gmtime_r(&now, &tmbuf);
         bytesLogged += strftime(buf+bytesLogged, bufSize-bytesLogged, mTimeFmt.c_str(), tmval);
@@ -193,26 +214,20 @@ void Logger::logString(krLogLevel level, const char* msg, unsigned flags, size_t
         return;
     }
 
+    if (len == (size_t)-1)
+        len = strlen(msg);
+
+    if (mAsyncEnabled.load(std::memory_order_acquire))
+    {
+        mAsyncLogger->push(level, msg, len, flags);
+        return;
+    }
+
     try
     {
         // This try-catch prevents crashes in app in case that mutex can't be adquire.
         LockGuard lock(mMutex);
-        if (len == (size_t)-1)
-            len = strlen(msg);
-
-        if (mConsoleLogger && ((flags & krLogNoConsole) == 0))
-            mConsoleLogger->logString(level, msg, flags);
-        if ((mFileLogger) && ((flags & krLogNoFile) == 0))
-            mFileLogger->logString(msg, len, flags);
-        if (!mUserLoggers.empty())
-        {
-            for (auto& logger: mUserLoggers)
-            {
-                ILoggerBackend* backend = logger.second;
-                if(level <= backend->maxLogLevel)
-                    backend->log(level, msg, len, flags);
-            }
-        }
+        writeString(level, msg, flags, len);
     }
     catch (std::system_error &e)
     {
@@ -220,6 +235,137 @@ void Logger::logString(krLogLevel level, const char* msg, unsigned flags, size_t
     }
 }
 
+void Logger::writeString(krLogLevel level, const char* msg, unsigned flags, size_t len)
+{
+    if (mConsoleLogger && ((flags & krLogNoConsole) == 0))
+        mConsoleLogger->logString(level, msg, flags);
+    if ((mFileLogger) && ((flags & krLogNoFile) == 0))
+        mFileLogger->logString(msg, len, flags);
+    if (!mUserLoggers.empty())
+    {
+        for (auto& logger: mUserLoggers)
+        {
+            ILoggerBackend* backend = logger.second;
+            if(level <= backend->maxLogLevel)
+                backend->log(level, msg, len, flags);
+        }
+    }
+}
+
+void Logger::flushOutputs()
+{
+    if (mFileLogger && ((mFlags & krLogNoAutoFlush) == 0))
+        mFileLogger->flush();
+}
+
+void Logger::logRecord(const LogRecord& rec)
+{
+    if (mAsyncEnabled.load(std::memory_order_acquire))
+    {
+        mAsyncLogger->push(rec);
+        return;
+    }
+
+    char buf[LOGGER_SPRINTF_BUF_SIZE];
+    size_t len = formatRecord(rec, buf, LOGGER_SPRINTF_BUF_SIZE);
+    logString(rec.level, buf, rec.flags | (mFlags & krGlobalFlagMask), len);
+}
+
+size_t Logger::formatRecord(const LogRecord& rec, char* buf, size_t bufSize)
+{
+    unsigned flags = rec.flags | (mFlags & krGlobalFlagMask);
+    size_t len = prependInfo(buf, bufSize, rec.prefix,
+        ((flags & krLogNoLevel) && (rec.level > krLogLevelWarn))
+            ? NULL
+            : krLogLevelNames[rec.level][0], flags, rec.ts);
+
+    const char* fmt = rec.fmt;
+    uint8_t argIdx = 0;
+    while (*fmt && len < bufSize - 1)
+    {
+        if (*fmt != '%')
+        {
+            buf[len++] = *fmt++;
+            continue;
+        }
+        if (fmt[1] == '%')
+        {
+            buf[len++] = '%';
+            fmt += 2;
+            continue;
+        }
+
+        // copy the conversion spec, without the length modifier, which depends on the stored type
+        char spec[32];
+        size_t specLen = 0;
+        spec[specLen++] = *fmt++;
+        while (*fmt && strchr("-+ #0123456789.", *fmt) && specLen < sizeof(spec) - 4)
+            spec[specLen++] = *fmt++;
+        while (*fmt && strchr("hlLqjzt", *fmt))
+            fmt++;
+        char conv = *fmt;
+        if (!conv)
+            break;
+        fmt++;
+
+        if (argIdx >= rec.argc)
+        {
+            assert(false);  // more conversions than arguments
+            break;
+        }
+        const LogArg& arg = rec.args[argIdx++];
+        bool isSignedConv = (conv == 'd' || conv == 'i');
+        int rv;
+        switch (arg.type)
+        {
+            case LogArg::kSigned:
+            case LogArg::kUnsigned:
+                if (conv == 'c')
+                {
+                    spec[specLen++] = 'c';
+                    spec[specLen] = 0;
+                    rv = snprintf(buf+len, bufSize-len, spec, (int)arg.i);
+                    break;
+                }
+                spec[specLen++] = 'l';
+                spec[specLen++] = 'l';
+                spec[specLen++] = conv;
+                spec[specLen] = 0;
+                rv = isSignedConv
+                    ? snprintf(buf+len, bufSize-len, spec, (long long)arg.i)
+                    : snprintf(buf+len, bufSize-len, spec, (unsigned long long)arg.u);
+                break;
+            case LogArg::kDouble:
+                spec[specLen++] = conv;
+                spec[specLen] = 0;
+                rv = snprintf(buf+len, bufSize-len, spec, arg.d);
+                break;
+            case LogArg::kHandle:
+            {
+                spec[specLen++] = 's';
+                spec[specLen] = 0;
+                std::string handle = base64urlencode(&arg.u, sizeof(arg.u));
+                rv = snprintf(buf+len, bufSize-len, spec, handle.c_str());
+                break;
+            }
+            case LogArg::kStaticStr:
+                spec[specLen++] = 's';
+                spec[specLen] = 0;
+                rv = snprintf(buf+len, bufSize-len, spec, arg.s ? arg.s : "(null)");
+                break;
+            default:
+                rv = 0;
+                break;
+        }
+        if (rv > 0)
+        {
+            len += std::min((size_t)rv, bufSize - 1 - len);
+        }
+    }
+    buf[len] = 0;
+    return len;
+}
+
  void Logger::log(const char* prefix, krLogLevel level, unsigned flags,
                 const char* fmtString, ...)
 {
@@ -233,12 +379,18 @@ std::shared_ptr<Logger::LogBuffer> Logger::loadLog()
 {
     if (!mFileLogger)
         return NULL;
+    if (mAsyncEnabled.load())
+        mAsyncLogger->flush();
     LockGuard lock(mMutex);
     return mFileLogger->loadLog();
 }
 
 Logger::~Logger()
 {
+    // stop the writer thread before locking, since it locks the logger to write
+    mAsyncEnabled.store(false);
+    mAsyncLogger.reset();
+
     LockGuard lock(mMutex);
     if (!mUserLoggers.empty())
     {
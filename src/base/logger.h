@@ -71,6 +71,10 @@ enum { krLogChannelCount = 32 };
 #include <memory>
 #include <mutex>
 #include <map>
+#include <atomic>
+#include <type_traits>
+#include <stdint.h>
+#include <time.h>
 
 class MyMegaApi;
 #define CHATLOGS_PORT 0
@@ -79,6 +83,80 @@ namespace karere
 {
 class FileLogger;
 class ConsoleLogger;
+class AsyncLogger;
+
+/** @brief An argument of a deferred log record, stored by value. Only values that
+ * remain valid after the call can be stored, so pointers are not accepted, except
+ * static strings wrapped by \c LogStaticStr
+ */
+struct LogArg
+{
+    enum: uint8_t { kSigned, kUnsigned, kDouble, kHandle, kStaticStr };
+    uint8_t type;
+    union
+    {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const char* s;
+    };
+};
+
+/** @brief Wraps a string with static storage (i.e. a literal) to be stored in a deferred log record */
+struct LogStaticStr
+{
+    const char* str;
+    explicit LogStaticStr(const char* aStr): str(aStr) {}
+};
+
+template <class T>
+inline typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value) || std::is_enum<T>::value, LogArg>::type
+makeLogArg(T val)
+{
+    LogArg arg;
+    arg.type = LogArg::kSigned;
+    arg.i = (int64_t)val;
+    return arg;
+}
+
+template <class T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, LogArg>::type
+makeLogArg(T val)
+{
+    LogArg arg;
+    arg.type = LogArg::kUnsigned;
+    arg.u = val;
+    return arg;
+}
+
+inline LogArg makeLogArg(double val)
+{
+    LogArg arg;
+    arg.type = LogArg::kDouble;
+    arg.d = val;
+    return arg;
+}
+
+inline LogArg makeLogArg(LogStaticStr val)
+{
+    LogArg arg;
+    arg.type = LogArg::kStaticStr;
+    arg.s = val.str;
+    return arg;
+}
+
+/** @brief A log record whose message is formatted when it's written */
+struct LogRecord
+{
+    enum { kMaxArgs = 8 };
+    const char* fmt;    // must be a literal
+    const char* prefix;
+    krLogLevel level;
+    unsigned flags;
+    time_t ts;
+    uint8_t argc;
+    LogArg args[kMaxArgs];
+};
 
 class KRLOGGER_DLLIMPEXP Logger
 {
@@ -91,13 +169,25 @@ protected:
     void setupFromEnvVar();
     std::unique_ptr<FileLogger> mFileLogger;
     std::unique_ptr<ConsoleLogger> mConsoleLogger;
+    /** Created upon the first call to logAsync(true), and kept until destruction */
+    std::unique_ptr<AsyncLogger> mAsyncLogger;
+    std::atomic<bool> mAsyncEnabled;
     volatile unsigned mFlags;
-    size_t prependInfo(char *buf, size_t bufSize, const char* prefix, const char* severity, unsigned flags);
+    size_t prependInfo(char *buf, size_t bufSize, const char* prefix, const char* severity, unsigned flags, time_t ts = 0);
 
     /** This is the low-level log function that does the actual logging
      *  of an assembled single string */
     void logString(krLogLevel level, const char* msg, unsigned flags, size_t len=(size_t)-1);
+    /** Writes the string to the outputs. The logger must be locked */
+    void writeString(krLogLevel level, const char* msg, unsigned flags, size_t len);
+    /** Flushes the log file, unless auto-flush is disabled. The logger must be locked */
+    void flushOutputs();
+    /** Formats the message of a deferred record. Returns the length of the message */
+    size_t formatRecord(const LogRecord& rec, char* buf, size_t bufSize);
+    /** Queues a deferred record if logging is asynchronous. Otherwise, formats and logs it */
+    void logRecord(const LogRecord& rec);
     std::map<std::string, ILoggerBackend*> mUserLoggers;
+    friend class AsyncLogger;
 public:
     std::recursive_mutex mMutex;
     typedef std::lock_guard<std::recursive_mutex> LockGuard;
@@ -113,10 +203,41 @@ public:
     void logToConsoleUseColors(bool useColors);
     void logToFile(const char* fileName, size_t rotateSize);
     void setAutoFlush(bool enable=true);
+    /** @brief Enables or disables the asynchronous logging
+     * When enabled, the calling thread only formats the message and queues it, and a
+     * dedicated thread writes it to the console, file and user loggers. Hence, user
+     * loggers are called from that thread.
+     * @param queueSize Max number of queued records. Only used the first time it's enabled
+     */
+    void logAsync(bool enable, size_t queueSize = 4096);
     Logger(unsigned flags = 0, const char* timeFmt="%m-%d %H:%M:%S");
     void logv(const char* prefix, krLogLevel level, unsigned flags, const char* fmtString, va_list aVaList);
     void log(const char* prefix, krLogLevel level, unsigned flags,
                 const char* fmtString, ...);
+
+    /** @brief Logs a message whose arguments are stored by value and formatted only when
+     * the message is written. With asynchronous logging, that happens in the writer thread.
+     * Supports integers, doubles, karere::Id (formatted as base64 by "%s") and \c LogStaticStr.
+     * Use it through the KARERE_LOGD_* macros.
+     */
+    template <class... Args>
+    void logDeferred(krLogChannelNo channel, krLogLevel level, const char* fmtString, const Args&... args)
+    {
+        static_assert(sizeof...(Args) <= LogRecord::kMaxArgs, "Too many arguments for a deferred log record");
+        LogArg argv[sizeof...(Args) + 1] = { makeLogArg(args)... };
+        LogRecord rec;
+        rec.fmt = fmtString;
+        rec.prefix = logChannels[channel].display;
+        rec.level = level;
+        rec.flags = logChannels[channel].flags;
+        rec.ts = time(NULL);
+        rec.argc = sizeof...(Args);
+        for (size_t i = 0; i < sizeof...(Args); i++)
+        {
+            rec.args[i] = argv[i];
+        }
+        logRecord(rec);
+    }
     std::shared_ptr<LogBuffer> loadLog();
 
     /** @brief Registers a user logger with the specified tag.
@@ -223,11 +344,13 @@ extern "C" KRLOGGER_DLLIMPEXP void krLoggerLogString(krLogChannelNo channel, krL
 extern "C" KRLOGGER_DLLIMPEXP krLogLevel krLogLevelStrToNum(const char* str);
 static inline int krLoggerWouldLog(krLogChannelNo channel, krLogLevel level)
 {
-    return (level <= krLoggerChannels[channel].logLevel);
+    return (level <= KRLOG_CHANNEL_MAX_LEVEL(channel)) && (level <= krLoggerChannels[channel].logLevel);
 }
 
+/** The arguments are evaluated only if the message will be logged. Messages above the
+ * compile-time max level of the channel (see loggerChannelConfig.h) are compiled out */
 #define KARERE_LOG(channel, level, fmtString,...)   \
-    ((level <= krLoggerChannels[channel].logLevel) ?  \
+    ((level <= KRLOG_CHANNEL_MAX_LEVEL(channel) && level <= krLoggerChannels[channel].logLevel) ?  \
        krLoggerLog(channel, level, fmtString "\n", ##__VA_ARGS__): void(0))
 
 #ifdef __cplusplus
@@ -238,8 +361,15 @@ static inline int krLoggerWouldLog(krLogChannelNo channel, krLogLevel level)
 #define KARERE_LOG_ERROR(channel, fmtString,...) KARERE_LOG(channel, krLogLevelError, fmtString, ##__VA_ARGS__)
 #define KARERE_LOG_ALWAYS(channel, fmtString,...) KARERE_LOG(channel, krLogLevelAlways, fmtString, ##__VA_ARGS__)
 
+/** Same as KARERE_LOG, but the message is formatted when it's written (see Logger::logDeferred) */
+#define KARERE_LOGD(channel, level, fmtString,...)   \
+    ((level <= KRLOG_CHANNEL_MAX_LEVEL(channel) && level <= krLoggerChannels[channel].logLevel) ?  \
+       karere::gLogger.logDeferred(channel, level, fmtString "\n", ##__VA_ARGS__): void(0))
+#define KARERE_LOGD_DEBUG(channel, fmtString,...) KARERE_LOGD(channel, krLogLevelDebug, fmtString, ##__VA_ARGS__)
+#define KARERE_LOGD_INFO(channel, fmtString,...) KARERE_LOGD(channel, krLogLevelInfo, fmtString, ##__VA_ARGS__)
+
 #define KARERE_LOGPP(channel, level, ...) \
-    if (level <= krLoggerChannels[channel].logLevel) \
+    if (level <= KRLOG_CHANNEL_MAX_LEVEL(channel) && level <= krLoggerChannels[channel].logLevel) \
     do { \
         std::ostringstream oss; \
         oss << __VA_ARGS__; \
@@ -0,0 +1,276 @@
+#ifndef LOGGERASYNC_H
+#define LOGGERASYNC_H
+
+#include "logger.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+namespace karere
+{
+/** @brief Asynchronous backend of the Logger
+ *
+ * Log records, already formatted by the caller or deferred (see Logger::logDeferred),
+ * are pushed to a bounded lock-free ring buffer that supports multiple producers and a
+ * single consumer. A dedicated thread pops them, formats the deferred ones and writes
+ * them in batches to the outputs of the logger, so callers never block on the log I/O.
+ * When the buffer is full, records are dropped and the number of dropped records is
+ * logged by the writer thread afterwards.
+ */
+class AsyncLogger
+{
+protected:
+    enum
+    {
+        kSlotSize = 256,        // records up to this size (including header) don't allocate
+        kMaxBatch = 256,        // max records written before flushing the outputs
+        kIdleWaitMs = 100,      // max time the writer sleeps when there are no records
+        kFormatBufSize = 10240  // max size of a formatted deferred record
+    };
+
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        krLogLevel level;
+        unsigned flags;
+        size_t len;             // zero for deferred records, which are stored as a LogRecord in data
+        char* heapData;         // only used by records that don't fit in data
+        union
+        {
+            char data[kSlotSize - sizeof(std::atomic<size_t>) - sizeof(krLogLevel)
+                      - sizeof(unsigned) - sizeof(size_t) - sizeof(char*)];
+            LogRecord record;
+        };
+    };
+    static_assert(sizeof(LogRecord) <= sizeof(Slot::data), "LogRecord doesn't fit in a slot");
+
+    Logger& mLogger;
+    Slot* mSlots;
+    size_t mMask;
+    std::atomic<size_t> mEnqueuePos;
+    std::atomic<size_t> mDequeuePos;    // only written by the writer thread
+    std::atomic<uint64_t> mDropped;
+    std::atomic<bool> mSleeping;
+    std::atomic<bool> mStop;
+    std::mutex mWakeMutex;
+    std::condition_variable mWakeCv;
+    std::thread mThread;
+    char mFormatBuf[kFormatBufSize];
+
+    Slot* front()
+    {
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        Slot* slot = &mSlots[pos & mMask];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        return (seq == pos + 1) ? slot : nullptr;
+    }
+
+    void pop(Slot* slot)
+    {
+        if (slot->heapData)
+        {
+            delete[] slot->heapData;
+            slot->heapData = nullptr;
+        }
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        slot->seq.store(pos + mMask + 1, std::memory_order_release);
+        mDequeuePos.store(pos + 1, std::memory_order_release);
+    }
+
+    /** Reserves a slot for a new record, or returns null if the buffer is full */
+    Slot* claim(size_t& pos)
+    {
+        Slot* slot;
+        pos = mEnqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            slot = &mSlots[pos & mMask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) // the writer has not released this slot yet
+            {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            else
+            {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        return slot;
+    }
+
+    /** Makes a claimed slot visible to the writer thread */
+    void publish(Slot* slot, size_t pos)
+    {
+        slot->seq.store(pos + 1, std::memory_order_release);
+        if (mSleeping.load())
+        {
+            mWakeCv.notify_one();
+        }
+    }
+
+    /** Writes up to kMaxBatch records to the outputs. Returns the number of records written */
+    size_t writeBatch()
+    {
+        uint64_t dropped = mDropped.load(std::memory_order_relaxed);
+        if (!front() && !dropped)
+            return 0;
+
+        size_t count = 0;
+        Logger::LockGuard lock(mLogger.mMutex);
+        Slot* slot;
+        while (count < kMaxBatch && (slot = front()))
+        {
+            if (slot->len)
+            {
+                mLogger.writeString(slot->level, slot->heapData ? slot->heapData : slot->data,
+                                    slot->flags | krLogNoAutoFlush, slot->len);
+            }
+            else
+            {
+                size_t len = mLogger.formatRecord(slot->record, mFormatBuf, kFormatBufSize);
+                mLogger.writeString(slot->level, mFormatBuf, slot->flags | krLogNoAutoFlush, len);
+            }
+            pop(slot);
+            count++;
+        }
+
+        if (dropped)
+        {
+            mDropped.fetch_sub(dropped, std::memory_order_relaxed);
+            char msg[128];
+            int len = snprintf(msg, sizeof(msg), "[LOGGER] Log buffer full, %s messages dropped\n",
+                               std::to_string(dropped).c_str());
+            mLogger.writeString(krLogLevelWarn, msg, krLogNoAutoFlush, len);
+            count++;
+        }
+
+        mLogger.flushOutputs();
+        return count;
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            if (writeBatch())
+                continue;
+
+            if (mStop.load())
+                break;
+
+            std::unique_lock<std::mutex> lock(mWakeMutex);
+            mSleeping.store(true);
+            if (!front() && !mStop.load())
+            {
+                // a wakeup lost in the race with a producer only delays the records by kIdleWaitMs
+                mWakeCv.wait_for(lock, std::chrono::milliseconds(kIdleWaitMs));
+            }
+            mSleeping.store(false);
+        }
+    }
+
+public:
+    enum { kDefaultCapacity = 4096 };
+
+    /** @param capacity Max number of records in the buffer. Rounded up to a power of 2 */
+    AsyncLogger(Logger& logger, size_t capacity = kDefaultCapacity)
+    : mLogger(logger), mEnqueuePos(0), mDequeuePos(0), mDropped(0), mSleeping(false), mStop(false)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        mMask = size - 1;
+        mSlots = new Slot[size];
+        for (size_t i = 0; i < size; i++)
+        {
+            mSlots[i].seq.store(i, std::memory_order_relaxed);
+            mSlots[i].heapData = nullptr;
+        }
+        mThread = std::thread([this]() { run(); });
+    }
+
+    /** @brief Queues a formatted record to be written by the writer thread. Can be called
+     * from any thread, and never blocks. Returns false if the record was dropped because
+     * the buffer is full.
+     */
+    bool push(krLogLevel level, const char* msg, size_t len, unsigned flags)
+    {
+        if (!len)
+            return true;
+
+        size_t pos;
+        Slot* slot = claim(pos);
+        if (!slot)
+            return false;
+
+        slot->level = level;
+        slot->flags = flags;
+        slot->len = len;
+        char* data = slot->data;
+        if (len >= sizeof(slot->data))
+        {
+            slot->heapData = data = new char[len + 1];
+        }
+        memcpy(data, msg, len);
+        data[len] = 0;
+        publish(slot, pos);
+        return true;
+    }
+
+    /** @brief Queues a deferred record, to be formatted by the writer thread */
+    bool push(const LogRecord& rec)
+    {
+        size_t pos;
+        Slot* slot = claim(pos);
+        if (!slot)
+            return false;
+
+        slot->level = rec.level;
+        slot->flags = rec.flags;
+        slot->len = 0;
+        slot->record = rec;
+        publish(slot, pos);
+        return true;
+    }
+
+    /** @brief Waits until the records queued so far have been written */
+    void flush()
+    {
+        assert(std::this_thread::get_id() != mThread.get_id());
+        size_t target = mEnqueuePos.load();
+        while ((intptr_t)(mDequeuePos.load(std::memory_order_acquire) - target) < 0)
+        {
+            mWakeCv.notify_one();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    ~AsyncLogger()
+    {
+        mStop.store(true);
+        mWakeCv.notify_one();
+        mThread.join();
+
+        // release records pushed after the writer exited, if any
+        while (Slot* slot = front())
+            pop(slot);
+
+        delete[] mSlots;
+    }
+};
+}
+#endif // LOGGERASYNC_H
@@ -26,7 +26,8 @@ console and application abort.
     0-7 correspond to terminal escape codes \033[0;30m - \033[0;37m. These are dark colors
     8-15 correspond to terminal escape codes \033[1;30m - \033[1;37m. These are bright colors
 <log_file> - if not NULL, enables logging to that file.
-<rotate_size> - the maximum size of the log file, in kbytes, after which the log file is truncated in half
+<rotate_size> - the maximum size of the log, in kbytes. The log is rotated in two segments of half that size:
+    the current file and <log_file>.1, which keeps the previous segment
 */
 #ifdef __APPLE__
     #define KR_WEAKSYM(func) func __attribute__ ((weak_import))
@@ -61,3 +62,66 @@ KR_LOGGER_CONFIG_START(
     KR_LOGGER_CONFIG(setFlags(krLogNoLevel))
     KR_LOGGER_CONFIG(logToConsole())
 KR_LOGGER_CONFIG_END()
+
+/* Compile-time max log level of each channel. Messages of higher levels are compiled out,
+ * so they have no runtime cost at all. By default, all levels are compiled in. It can be
+ * restricted for all channels with KRLOG_MAX_LEVEL, or per channel with KRLOG_MAX_LEVEL_<channel_id>,
+ * i.e. -DKRLOG_MAX_LEVEL=krLogLevelInfo -DKRLOG_MAX_LEVEL_chatd=krLogLevelWarn
+ */
+#ifndef KRLOG_MAX_LEVEL
+    #define KRLOG_MAX_LEVEL krLogLevelLast
+#endif
+#ifndef KRLOG_MAX_LEVEL_rtc
+    #define KRLOG_MAX_LEVEL_rtc KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_rtcevent
+    #define KRLOG_MAX_LEVEL_rtcevent KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_megasdk
+    #define KRLOG_MAX_LEVEL_megasdk KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_services
+    #define KRLOG_MAX_LEVEL_services KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_strongvelope
+    #define KRLOG_MAX_LEVEL_strongvelope KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_websockets
+    #define KRLOG_MAX_LEVEL_websockets KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_chatd
+    #define KRLOG_MAX_LEVEL_chatd KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_gui
+    #define KRLOG_MAX_LEVEL_gui KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_uacache
+    #define KRLOG_MAX_LEVEL_uacache KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_megachatapi
+    #define KRLOG_MAX_LEVEL_megachatapi KRLOG_MAX_LEVEL
+#endif
+#ifndef KRLOG_MAX_LEVEL_presenced
+    #define KRLOG_MAX_LEVEL_presenced KRLOG_MAX_LEVEL
+#endif
+
+#ifdef __cplusplus
+constexpr krLogLevel krLogChannelMaxLevel(krLogChannelNo channel)
+{
+    return (channel == krLogChannel_rtc) ? KRLOG_MAX_LEVEL_rtc
+         : (channel == krLogChannel_rtcevent) ? KRLOG_MAX_LEVEL_rtcevent
+         : (channel == krLogChannel_megasdk) ? KRLOG_MAX_LEVEL_megasdk
+         : (channel == krLogChannel_services) ? KRLOG_MAX_LEVEL_services
+         : (channel == krLogChannel_strongvelope) ? KRLOG_MAX_LEVEL_strongvelope
+         : (channel == krLogChannel_websockets) ? KRLOG_MAX_LEVEL_websockets
+         : (channel == krLogChannel_chatd) ? KRLOG_MAX_LEVEL_chatd
+         : (channel == krLogChannel_gui) ? KRLOG_MAX_LEVEL_gui
+         : (channel == krLogChannel_uacache) ? KRLOG_MAX_LEVEL_uacache
+         : (channel == krLogChannel_megachatapi) ? KRLOG_MAX_LEVEL_megachatapi
+         : (channel == krLogChannel_presenced) ? KRLOG_MAX_LEVEL_presenced
+         : KRLOG_MAX_LEVEL;
+}
+    #define KRLOG_CHANNEL_MAX_LEVEL(channel) krLogChannelMaxLevel(channel)
+#else
+    #define KRLOG_CHANNEL_MAX_LEVEL(channel) KRLOG_MAX_LEVEL
+#endif
@@ -3,9 +3,15 @@
 
 #include "logger.h"
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 
 namespace karere
 {
+/** Logs to a file, which is rotated by segments: when the current file reaches
+ * rotateSize / segments bytes, it's renamed to <file>.1, the previous <file>.1 to <file>.2
+ * and so on, and the oldest segment is removed. Hence, rotating doesn't depend on the size.
+ */
 class FileLogger
 {
 protected:
@@ -14,17 +20,26 @@ protected:
     std::string mFileName;
     volatile unsigned& mFlags;
     long mLogSize;
+    int mSegments;
 public:
+    enum { kDefaultSegments = 2 };
     void setRotateSize(unsigned rotateSize) { mRotateSize = rotateSize; }
 
-FileLogger(volatile unsigned& flags, const char* logFile, int rotateSize)
- :mFile(NULL), mRotateSize(rotateSize), mFlags(flags), mLogSize(0)
+FileLogger(volatile unsigned& flags, const char* logFile, int rotateSize, int segments = kDefaultSegments)
+ :mFile(NULL), mRotateSize(rotateSize), mFlags(flags), mLogSize(0), mSegments(segments)
 {
     assert(rotateSize > 0);
+    assert(segments > 1);
     if (logFile)
         startLogging(logFile);
 }
 
+/** Returns the name of the segment file, where 0 is the current one and mSegments-1 the oldest */
+std::string segmentName(int segment) const
+{
+    return segment ? (mFileName + "." + std::to_string(segment)) : mFileName;
+}
+
 void startLogging(const char* fileName)
 {
 	if (mFile)
@@ -46,24 +61,48 @@ void logString(const char* buf, size_t len, unsigned flags)
 {
 //    std::lock_guard<std::mutex> lock(mMutex);
     //do not increment mLogSize until we have actually written the data
-    if (mLogSize >= mRotateSize)
+    if (mLogSize >= mRotateSize / mSegments)
         rotateLog();
     mLogSize += len;
     size_t ret = fwrite(buf, 1, len, mFile);
     if (ret != len)
         perror("FileLogger: WARNING: Error writing to log file: ");
-    if ((mFlags & krLogNoAutoFlush) == 0)
+    if (((mFlags | flags) & krLogNoAutoFlush) == 0)
+        fflush(mFile);
+}
+
+void flush()
+{
+    if (mFile)
         fflush(mFile);
 }
 
 
+/** Returns the content of all the segments, from the oldest to the current one */
 std::shared_ptr<Logger::LogBuffer> loadLog() //Logger must be locked!!!
 {
-    std::shared_ptr<Logger::LogBuffer> buf(new Logger::LogBuffer(new char[mLogSize+1], mLogSize+1));
-    if (!buf->data)
-        throw std::runtime_error("FileLogger::loadLog: Out of memory when allocating buffer");
+    fflush(mFile);
+    std::string content;
+    for (int i = mSegments - 1; i > 0; i--)
+    {
+        FILE* segment = fopen(segmentName(i).c_str(), "rb");
+        if (!segment)
+            continue;
+
+        char chunk[4096];
+        size_t bytesRead;
+        while ((bytesRead = fread(chunk, 1, sizeof(chunk), segment)) > 0)
+            content.append(chunk, bytesRead);
+        if (ferror(segment))
+            perror("ERROR: FileLogger::loadLog: Error reading log segment: ");
+        fclose(segment);
+    }
+
+    size_t size = content.size() + mLogSize;
+    std::shared_ptr<Logger::LogBuffer> buf(new Logger::LogBuffer(new char[size+1], size+1));
+    memcpy(buf->data, content.data(), content.size());
     fseek(mFile, 0, SEEK_SET);
-    long bytesRead = fread(buf->data, 1, mLogSize, mFile);
+    long bytesRead = fread(buf->data + content.size(), 1, mLogSize, mFile);
     if (bytesRead != mLogSize)
     {
         if (ferror(mFile))
@@ -73,49 +112,33 @@ std::shared_ptr<Logger::LogBuffer> loadLog() //Logger must be locked!!!
         else
             fprintf(stderr, "ERROR: FileLogger::loadLog: Unknown error has occurred while reading file. ferror() and feof() were not set");
 
+        fseek(mFile, 0, SEEK_END);
         return NULL;
     }
-    buf->data[mLogSize] = 0; //zero terminate the string in the buffer
+    buf->data[size] = 0; //zero terminate the string in the buffer
     fseek(mFile, 0, SEEK_END);
     return buf;
 }
 
 void rotateLog()
 {
-    auto buf = loadLog();
-    long slicePos = mLogSize - (mRotateSize / 2);
-    if (slicePos <= 1)
-        throw std::runtime_error("FileLogger::rotate: The slice offset is less than 1");
-    if (slicePos >= mLogSize - 1)
-        throw std::runtime_error("FileLogger::rotate: The slice offset is at the end of the log. Rotate size is too small");
-
-    long i;
-    for (i = slicePos; i >= 0; i--)
-        if (buf->data[i] == '\n')
-            break;
-//i shoud point to a \n or be -1
-//It is guaranteed that the highest value of i (=half) is
-//at least 1 less that the end of the buf (see checks above)
-    if (i > 0)
-        slicePos = i+1;
-//else no new line found in the half->beginning backward scan, so just truncate and dont care about newlines
-
-    fclose(mFile); //writing appends to the end of the file, and now we want to rewrite it
+    fclose(mFile);
     mFile = NULL;
-    FILE* writeFile = fopen(mFileName.c_str(), "wb");
-    if (!writeFile)
-        throw std::runtime_error("FileLogger::rotate: Cannot open log file for rewriting");
-    int writeLen = mLogSize-slicePos;
-    int ret = fwrite(buf->data+slicePos, 1, writeLen, writeFile);
-    if (ret != writeLen)
+
+    // shift the segments, dropping the oldest one
+    for (int i = mSegments - 1; i > 0; i--)
     {
-        if (ret < 0)
-            perror("ERROR: FileLogger::rotate: Error writing file:");
-        else
-            fprintf(stderr, "ERROR: FileLogger::rotate: Not all data could be written to file: requested %d, written: %d\n",
-                writeLen, ret);
+        std::string older = segmentName(i);
+        remove(older.c_str()); //rename() doesn't replace existing files in Windows
+        if (rename(segmentName(i - 1).c_str(), older.c_str()) && i == 1)
+        {
+            // don't keep appending to the current file, it would be rotated again on every write
+            perror("ERROR: FileLogger::rotate: Error renaming the log file, truncating it: ");
+            FILE* truncFile = fopen(mFileName.c_str(), "wb");
+            if (truncFile)
+                fclose(truncFile);
+        }
     }
-    fclose(writeFile);
     openLogFile();
 }
 
@@ -1,10 +1,16 @@
 #ifndef __BUFFER_H__
 #define __BUFFER_H__
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <stdexcept>
 #include <string.h>
 #include <vector>
+#include <atomic>
+#include <new>
+#ifdef _WIN32
+    #include <malloc.h>
+#endif
 
 #if !defined(__arm__) && !defined(__aarch64__)
     #define BUFFER_ALLOW_UNALIGNED_MEMORY_ACCESS 1
@@ -161,9 +167,100 @@ public:
     }
 };
 
+/** @brief Bump allocator of small blocks, used to store the data of many long-lived
+ * Buffers (e.g. the messages of a chat) without a heap allocation per buffer.
+ * Blocks are carved out of chunks of \c kChunkSize bytes, which are aligned to their
+ * size, so the chunk of a block is found from its address. Each chunk counts its live
+ * blocks, and is freed when the last one is released and the arena has moved on to a
+ * newer chunk. Allocation is not thread-safe, releasing a block is.
+ */
+class BufferArena
+{
+public:
+    enum { kChunkSize = 16384, kMaxBlockSize = kChunkSize / 4, kAlign = 8 };
+    BufferArena() {}
+    BufferArena(const BufferArena&) = delete;
+    BufferArena& operator=(const BufferArena&) = delete;
+    ~BufferArena()
+    {
+        if (mChunk)
+            releaseChunk(mChunk);
+    }
+    /** Returns a block of \c size bytes, or nullptr if it's larger than \c kMaxBlockSize
+     * or there is no memory for a new chunk */
+    char* alloc(size_t size)
+    {
+        if (!size || size > kMaxBlockSize)
+            return nullptr;
+        size = (size + kAlign - 1) & ~(size_t)(kAlign - 1);
+        if (!mChunk || mOffset + size > kChunkSize)
+        {
+            Chunk* chunk = newChunk();
+            if (!chunk)
+                return nullptr;
+            if (mChunk)
+                releaseChunk(mChunk);
+            mChunk = chunk;
+            mOffset = kHeaderSize;
+        }
+        char* block = reinterpret_cast<char*>(mChunk) + mOffset;
+        mOffset += size;
+        mChunk->refs++;
+        return block;
+    }
+    static void release(void* block)
+    {
+        releaseChunk(reinterpret_cast<Chunk*>((uintptr_t)block & ~(uintptr_t)(kChunkSize - 1)));
+    }
+    /** Number of chunks allocated by all the arenas */
+    static size_t chunkCount() { return sChunkCount(); }
+protected:
+    struct Chunk
+    {
+        std::atomic<size_t> refs;
+        Chunk(): refs(1) {} // the reference of the arena
+    };
+    enum { kHeaderSize = (sizeof(Chunk) + kAlign - 1) & ~(kAlign - 1) };
+    Chunk* mChunk = nullptr;
+    size_t mOffset = 0;
+    static std::atomic<size_t>& sChunkCount()
+    {
+        static std::atomic<size_t> count(0);
+        return count;
+    }
+    static Chunk* newChunk()
+    {
+        void* mem;
+#ifdef _WIN32
+        mem = _aligned_malloc(kChunkSize, kChunkSize);
+#else
+        if (posix_memalign(&mem, kChunkSize, kChunkSize))
+            mem = nullptr;
+#endif
+        if (!mem)
+            return nullptr;
+        sChunkCount()++;
+        return new (mem) Chunk;
+    }
+    static void releaseChunk(Chunk* chunk)
+    {
+        if (--chunk->refs)
+            return;
+        chunk->~Chunk();
+        sChunkCount()--;
+#ifdef _WIN32
+        _aligned_free(chunk);
+#else
+        ::free(chunk);
+#endif
+    }
+};
+
 class Buffer: public StaticBuffer
 {
 protected:
+    /** The size of the malloc'ed block. It's 0 when the data is in a BufferArena block,
+     * whose capacity is the data size: growing the data moves it to the heap */
     size_t mBufSize;
     enum {kMinBufSize = 64};
     void zero()
@@ -172,10 +269,29 @@ protected:
         mBufSize = 0;
         mDataSize = 0;
     }
+    bool inArena() const { return mBuf && !mBufSize; }
+    void releaseBuf()
+    {
+        if (mBufSize)
+            ::free(mBuf);
+        else
+            BufferArena::release(mBuf);
+    }
+    void moveToHeap(size_t size)
+    {
+        assert(inArena() && size >= mDataSize);
+        char* buf = (char*)::malloc(size);
+        if (!buf)
+            throw std::runtime_error("Buffer::moveToHeap: Out of memory allocating block of size "+ std::to_string(size));
+        memcpy(buf, mBuf, mDataSize);
+        BufferArena::release(mBuf);
+        mBuf = buf;
+        mBufSize = size;
+    }
 public:
     char* buf() { return mBuf;}
     const char* buf() const { return mBuf;}
-    size_t bufSize() const { return mBufSize;}
+    size_t bufSize() const { return inArena() ? mDataSize : mBufSize; }
     Buffer(size_t size=kMinBufSize, size_t dataSize=0)
     {
         assert(dataSize <= size);
@@ -216,6 +332,11 @@ public:
     Buffer(const std::string& src)
     {
         mBufSize = withNull ? src.size()+1 : src.size();
+        if (!mBufSize)
+        {
+            zero();
+            return;
+        }
         mBuf = (char*)malloc(mBufSize);
         memcpy(mBuf, src.c_str(), mBufSize);
         mDataSize = mBufSize;
@@ -224,13 +345,13 @@ public:
     {
         if (mBuf)
         {
-            if (datalen <= mBufSize)
+            if (datalen <= bufSize())
             {
                 memcpy(mBuf, data, datalen);
                 mDataSize = datalen;
                 return;
             }
-            ::free(mBuf);
+            releaseBuf();
         }
         mBufSize = (kMinBufSize > datalen) ? (size_t) kMinBufSize : datalen;
         mBuf = (char*)malloc(mBufSize);
@@ -245,10 +366,26 @@ public:
     template <bool withNull>
     void assign(const std::string& src) { assign(src.c_str(), withNull?(src.size()+1):src.size()); }
     void copyFrom(const StaticBuffer& src) { assign(src.buf(), src.dataSize()); }
+    /** Moves the data to a block of \c arena, if it fits. Returns whether it was moved */
+    bool moveToArena(BufferArena& arena)
+    {
+        if (!mBufSize || !mDataSize)
+            return false;
+        char* block = arena.alloc(mDataSize);
+        if (!block)
+            return false;
+        memcpy(block, mBuf, mDataSize);
+        ::free(mBuf);
+        mBuf = block;
+        mBufSize = 0;
+        return true;
+    }
     void reserve(size_t size)
     {
         if (!mBuf)
         {
+            if (!size)
+                return;
             mBuf = (char*)::malloc(size);
             mBufSize = size;
             assert(mDataSize == 0);
@@ -256,8 +393,13 @@ public:
         else
         {
             size_t newsize = mDataSize+size;
-            if (newsize <= mBufSize)
+            if (newsize <= bufSize())
+                return;
+            if (inArena())
+            {
+                moveToHeap(newsize);
                 return;
+            }
             char* save = mBuf;
             mBuf = (char*)::realloc(mBuf, newsize);
             if (!mBuf)
@@ -270,14 +412,14 @@ public:
     }
     void setDataSize(size_t size)
     {
-        if (size > mBufSize)
+        if (size > bufSize())
             throw std::runtime_error("setDataSize: Attempted to set dataSize to span beyond bufferSize");
         mDataSize = size;
     }
     char* writePtr(size_t offset, size_t dataLen)
     {
         auto reqdSize = offset+dataLen;
-        if (reqdSize > mBufSize)
+        if (reqdSize > bufSize())
         {
             reserve(reqdSize);
             mDataSize = reqdSize;
@@ -305,7 +447,11 @@ public:
         }
         else
         {
-            if (reqdSize > mBufSize)
+            if (inArena())
+            {
+                moveToHeap(reqdSize);
+            }
+            else if (reqdSize > mBufSize)
             {
                 auto save = mBuf;
                 mBuf = (char*)::realloc(mBuf, reqdSize);
@@ -346,7 +492,7 @@ public:
     {
         if (!mBuf)
             return;
-        ::free(mBuf);
+        releaseBuf();
         mBuf = nullptr;
         mBufSize = mDataSize = 0;
     }
@@ -354,7 +500,7 @@ public:
     ~Buffer()
     {
         if (mBuf)
-            ::free(mBuf);
+            releaseBuf();
     }
 };
 #endif
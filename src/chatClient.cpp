@@ -79,6 +79,7 @@ Client::Client(::mega::MegaApi& sdk, WebsocketsIO *websocketsIO, IApp& aApp, con
           api(sdk, ctx),
           app(aApp),
           mDnsCache(db, chatd::Client::chatdVersion),
+          mDecryptWorkerPool(new strongvelope::DecryptWorkerPool(strongvelope::DecryptWorkerPool::defaultThreadCount(), ctx)),
           mContactList(new ContactList(*this)),
           chats(new ChatRoomList(*this)),
           mPresencedClient(&api, this, *this, caps)
@@ -320,6 +321,24 @@ bool Client::openDb(const std::string& sid)
                 ok = true;
                 KR_LOG_WARNING("Database version has been updated to %s", gDbSchemaVersionSuffix);
             }
+            else if (cachedVersionSuffix == "9" && (strcmp(gDbSchemaVersionSuffix, "10") == 0))
+            {
+                KR_LOG_WARNING("Updating schema of MEGAchat cache...");
+
+                // Add the persisted unread count to chats table (null until computed)
+                db.query("ALTER TABLE `chats` ADD unread_count int");
+
+                // Add partial indexes for the unread count, last text message and missed calls queries
+                db.simpleQuery("CREATE INDEX history_unread ON history(chatid, idx, userid, is_encrypted)"
+                               "    WHERE type IN (1, 101, 103, 104, 105) AND NOT (updated != 0 AND length(data) = 0);"
+                               "CREATE INDEX history_last_text ON history(chatid, idx)"
+                               "    WHERE (length(data) > 0 OR type = 3) AND type != 102 AND type != 0;"
+                               "CREATE INDEX history_call_end ON history(chatid, idx) WHERE type = 6;");
+                db.query("update vars set value = ? where name = 'schema_version'", currentVersion);
+                db.commit();
+                ok = true;
+                KR_LOG_WARNING("Database version has been updated to %s", gDbSchemaVersionSuffix);
+            }
         }
     }
 
@@ -603,6 +622,10 @@ void Client::heartbeat()
 {
     if (db.isOpen())
     {
+        if (mChatdClient)
+        {
+            mChatdClient->persistUnreadCounts();
+        }
         db.timedCommit();
     }
 
@@ -617,6 +640,50 @@ void Client::heartbeat()
     {
         mChatdClient->heartbeat();
     }
+
+    refreshDnsCache(false);
+}
+
+void Client::refreshDnsCache(bool force)
+{
+    auto wptr = weakHandle();
+    for (int shard : mDnsCache.getShardsToRefresh(force))
+    {
+        std::string host = mDnsCache.getUrl(shard).host;
+        KR_LOG_DEBUG("Refreshing DNS cache for %s...", host.c_str());
+        mDnsResolver.wsResolveDNS(websocketIO, host.c_str(),
+                                  [wptr, this, shard, host](int statusDNS, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6)
+        {
+            if (wptr.deleted() || isTerminated())
+            {
+                return;
+            }
+
+            if (!mDnsCache.isValidUrl(shard) || mDnsCache.getUrl(shard).host != host)
+            {
+                KR_LOG_DEBUG("DNS cache refresh for %s ignored: the URL has changed", host.c_str());
+                return;
+            }
+
+            if (statusDNS < 0 || (ipsv4.empty() && ipsv6.empty()))
+            {
+                // keep the expired IPs, they are retried by the next refresh or resolved by the next reconnection
+                KR_LOG_WARNING("DNS cache refresh for %s failed. Error code: %d", host.c_str(), statusDNS);
+                return;
+            }
+
+            if (mDnsCache.setIp(shard, ipsv4, ipsv6))
+            {
+                KR_LOG_DEBUG("DNS cache refresh: IPs for %s have changed", host.c_str());
+#ifndef KARERE_DISABLE_WEBRTC
+                if (rtc && shard <= TURNSERVER_SHARD)
+                {
+                    rtc->updateTurnServers();
+                }
+#endif
+            }
+        });
+    }
 }
 
 Client::~Client()
@@ -657,6 +724,13 @@ void Client::retryPendingConnections(bool disconnect, bool refreshURL)
         rtc->refreshTurnServerIp();
     }
 #endif
+
+    if (disconnect)
+    {
+        // the network may have changed: refresh the cached IPs in background, so
+        // the reconnections don't need to wait for the DNS resolution
+        refreshDnsCache(true);
+    }
 }
 
 promise::Promise<void> Client::notifyUserStatus(bool background)
@@ -1101,6 +1175,7 @@ void Client::initWithDbSession(const char* sid)
 
         loadOwnKeysFromDb();
         mDnsCache.loadFromDb();
+        refreshDnsCache(false);     // prefetch the IPs of known hosts before connecting
         mContactList->loadFromDb();
         mChatdClient.reset(new chatd::Client(this));
         chats->loadFromDb();
@@ -1759,6 +1834,16 @@ void Client::onPresenceChange(Id userid, Presence pres, bool inProgress)
     app.onPresenceChanged(userid, pres, inProgress);
 }
 
+void Client::onPresenceChanges(const std::map<Id, Presence>& changes)
+{
+    if (isTerminated())
+    {
+        return;
+    }
+
+    app.onPresencesChanged(changes);
+}
+
 void Client::onPresenceConfigChanged(const presenced::Config& state, bool pending)
 {
     app.onPresenceConfigChanged(state, pending);
@@ -1809,6 +1894,9 @@ void Client::terminate(bool deleteDb)
 
     setInitState(kInitTerminated);
 
+    // pending decryptions are marshalled back as cancelled, before appCtx goes away
+    mDecryptWorkerPool->shutdown();
+
     api.sdk.removeRequestListener(this);
     api.sdk.removeGlobalListener(this);
 
@@ -1862,6 +1950,10 @@ void Client::terminate(bool deleteDb)
         else if (db.isOpen())
         {
             KR_LOG_INFO("Doing final COMMIT to database");
+            if (mChatdClient)
+            {
+                mChatdClient->persistUnreadCounts();
+            }
             db.commit();
             db.close();
         }
@@ -2088,13 +2180,29 @@ bool ChatRoom::isChatdChatInitialized()
     return mChat;
 }
 
+void Client::setHistoryResidentLimits(chatd::Idx perChat, size_t total)
+{
+    mHistoryResidentWindow = perChat;
+    mHistoryResidentCap = total;
+    if (mChatdClient)
+    {
+        mChatdClient->trimHistory();
+    }
+}
+
 strongvelope::ProtocolHandler* Client::newStrongvelope(karere::Id chatid, bool isPublic,
         std::shared_ptr<std::string> unifiedKey, int isUnifiedKeyEncrypted, karere::Id ph)
 {
-    return new strongvelope::ProtocolHandler(mMyHandle,
+    strongvelope::ProtocolHandler* crypto = new strongvelope::ProtocolHandler(mMyHandle,
          StaticBuffer(mMyPrivCu25519, 32), StaticBuffer(mMyPrivEd25519, 32),
          StaticBuffer(mMyPrivRsa, mMyPrivRsaLen), *mUserAttrCache, db, chatid,
          isPublic, unifiedKey, isUnifiedKeyEncrypted, ph, appCtx);
+    crypto->setDecryptWorkerPool(mDecryptWorkerPool.get());
+    if (!mLazyChatInit)
+    {
+        crypto->loadKeysFromDb();
+    }
+    return crypto;
 }
 
 void ChatRoom::createChatdChat(const karere::SetOfIds& initialUsers, bool isPublic,
@@ -3247,6 +3355,8 @@ void ChatRoom::setAppChatHandler(IApp::IChatHandler* handler)
 
     mAppChatHandler = handler;
     chatd::DbInterface* dummyIntf = nullptr;
+    // load the history deferred at startup before the app becomes the listener
+    mChat->loadHistoryWindow();
 // mAppChatHandler->init() may rely on some events, so we need to set mChatWindow as listener before
 // calling init(). This is safe, as and we will not get any async events before we
 //return to the event loop
@@ -3260,6 +3370,10 @@ void ChatRoom::removeAppChatHandler()
         return;
     mAppChatHandler = nullptr;
     mChat->setListener(this);
+
+    // the app is not viewing the history anymore, keep only the newest messages in RAM
+    mChat->resetGetHistory();
+    mChat->trimHistory(parent.mKarereClient.historyResidentWindow());
 }
 
 bool ChatRoom::hasChatHandler() const
@@ -4584,6 +4698,7 @@ std::string InitStats::shardStageToString(uint8_t stage)
         case kStatsQueryDns: return "Query DNS";
         case kStatsConnect: return "Connect";
         case kStatsLoginChatd: return "Login all chats";
+        case kStatsJoinChats: return "Join all chats";
         default: return "(unknown)";
     }
 }
@@ -31,7 +31,7 @@
 
 namespace mega { class MegaTextChat; class MegaTextChatList; }
 
-namespace strongvelope { class ProtocolHandler; }
+namespace strongvelope { class ProtocolHandler; class DecryptWorkerPool; }
 
 struct sqlite3;
 class Buffer;
@@ -638,8 +638,9 @@ class InitStats
          * - Version 1: Initial version
          * - Version 2: Fix errors and discard atypical values
          * - Version 3: Implement DNS, Chatd and Presenced Ip/Url cache
+         * - Version 4: Add batched join of all chats per shard
          */
-        const uint32_t INITSTATSVERSION = 3;
+        const uint32_t INITSTATSVERSION = 4;
 
         /** @brief Init states in init stats */
         enum
@@ -667,7 +668,8 @@ class InitStats
             kStatsFetchChatUrl      = 0,
             kStatsQueryDns          = 1,
             kStatsConnect           = 2,
-            kStatsLoginChatd        = 3
+            kStatsLoginChatd        = 3,
+            kStatsJoinChats         = 4     // time to send the login of all the chats in the shard
         };
 
         std::string onCompleted(long long numNodes, size_t numChats, size_t numContacts);
@@ -871,6 +873,17 @@ public:
     SqliteDb db;                // db-layer interface
     DNScache mDnsCache;         // dns cache
 
+    // decrypts messages of all chats off the karere thread. Declared
+    // before the chats, since their ProtocolHandlers use it
+    std::unique_ptr<strongvelope::DecryptWorkerPool> mDecryptWorkerPool;
+
+    // see setLazyChatInit()
+    bool mLazyChatInit = false;
+
+    // see setHistoryResidentLimits()
+    chatd::Idx mHistoryResidentWindow = chatd::Client::kDefaultHistoryResidentWindow;
+    size_t mHistoryResidentCap = 0;
+
     std::unique_ptr<chatd::Client> mChatdClient;
 
 #ifndef KARERE_DISABLE_WEBRTC
@@ -925,6 +938,9 @@ protected:
     megaHandle mHeartbeatTimer = 0;
     InitStats mInitStats;
 
+    // resolves the hostnames in DNS cache in background, see refreshDnsCache()
+    DnsResolver mDnsResolver;
+
     // Maps uhBin to user alias encoded in B64
     AliasesMap mAliasesMap;
     bool mIsInBackground = false;
@@ -1125,6 +1141,27 @@ public:
     void dumpChatrooms(::mega::MegaTextChatList& chatRooms);
     void dumpContactList(::mega::MegaUserList& clist);
     bool anonymousMode() const;
+
+    /**
+     * @brief Enables or disables the lazy initialization of chats (disabled by default).
+     * In lazy mode, chats created from the local cache don't load their history window
+     * and send keys from db until they are used. It only applies to chats created after the call.
+     */
+    void setLazyChatInit(bool enable) { mLazyChatInit = enable; }
+    bool lazyChatInit() const { return mLazyChatInit; }
+
+    /**
+     * @brief Sets the limits of messages kept in the RAM history buffers of the chats.
+     * Evicted messages remain in db and are loaded again when needed.
+     * @param perChat Messages kept per chat, besides the older range being viewed by
+     * the app (zero to keep all of them)
+     * @param total Messages kept across all chats (zero for no limit). When exceeded, chats
+     * are trimmed to \c perChat messages, or to \c initialHistoryFetchCount if needed.
+     */
+    void setHistoryResidentLimits(chatd::Idx perChat, size_t total);
+    chatd::Idx historyResidentWindow() const { return mHistoryResidentWindow; }
+    size_t historyResidentCap() const { return mHistoryResidentCap; }
+
     bool isChatRoomOpened(Id chatid);
     void updateAndNotifyLastGreen(Id userid);
     InitStats &initStats();
@@ -1142,6 +1179,12 @@ public:
 
 protected:
     void heartbeat();
+
+    /** @brief Resolves in background the hostnames of the DNS cache (chatd shards, presenced and
+     * TURN servers from Gelb) whose IPs have expired, or all of them if \c force, so connections
+     * can use fresh IPs without waiting for the DNS resolution.
+     */
+    void refreshDnsCache(bool force);
     void setInitState(InitState newState);
 
     // db-related methods
@@ -1190,6 +1233,7 @@ protected:
     // presenced listener interface
     virtual void onConnStateChange(presenced::Client::ConnState state);
     virtual void onPresenceChange(Id userid, Presence pres, bool inProgress = false);
+    virtual void onPresenceChanges(const std::map<Id, Presence>& changes);
     virtual void onPresenceConfigChanged(const presenced::Config& state, bool pending);
     virtual void onPresenceLastGreenUpdated(karere::Id userid);
 
@@ -29,6 +29,8 @@ using ::mega::mega_snprintf;   // enables the calls to snprintf below which are
 #define CHATDS_LOG_DEBUG(fmtString,...) CHATD_LOG_DEBUG("[shard %d]: " fmtString, shardNo(), ##__VA_ARGS__)
 #define CHATDS_LOG_WARNING(fmtString,...) CHATD_LOG_WARNING("[shard %d]: " fmtString, shardNo(), ##__VA_ARGS__)
 #define CHATDS_LOG_ERROR(fmtString,...) CHATD_LOG_ERROR("[shard %d]: " fmtString, shardNo(), ##__VA_ARGS__)
+// deferred version for the hot path: ids are passed as karere::Id and formatted only when written
+#define CHATDS_LOGD_DEBUG(fmtString,...) CHATD_LOGD_DEBUG("[shard %d]: " fmtString, shardNo(), ##__VA_ARGS__)
 
 #ifdef CHATD_LOG_LISTENER_CALLS
     #define CHATD_LOG_LISTENER_CALL(fmtString,...) CHATID_LOG_DEBUG(fmtString, ##__VA_ARGS__)
@@ -169,22 +171,18 @@ Client::Client(karere::Client *aKarereClient) :
        });
     }
 
-    // initialize the most recent message for each user
-    SqliteStmt stmt1(mKarereClient->db, "SELECT DISTINCT userid FROM history");
-    while (stmt1.step())
+    // initialize the most recent message for each user. It's the only query that reads
+    // the whole history (once, at startup), so it's not indexed
+    SqliteStmt stmt(mKarereClient->db, "SELECT userid, MAX(ts) FROM history GROUP BY userid");
+    while (stmt.step())
     {
-        karere::Id userid = stmt1.uint64Col(0);
+        karere::Id userid = stmt.uint64Col(0);
         if (userid == Id::COMMANDER())
         {
             continue;
         }
 
-        SqliteStmt stmt2(mKarereClient->db, "SELECT MAX(ts) FROM history WHERE userid = ?");
-        stmt2 << userid.val;
-        if (stmt2.step())
-        {
-            mLastMsgTs[userid] = stmt2.uintCol(0);
-        }
+        mLastMsgTs[userid] = stmt.uintCol(1);
     }
 }
 
@@ -342,6 +340,43 @@ void Client::cancelSeenTimers()
    mSeenTimers.clear();
 }
 
+void Client::trimHistory()
+{
+    size_t cap = mKarereClient->historyResidentCap();
+    if (!cap)
+    {
+        return;
+    }
+
+    size_t total = 0;
+    for (auto& it: mChatForChatId)
+    {
+        total += it.second->size();
+    }
+    if (total <= cap)
+    {
+        return;
+    }
+
+    // first to the per-chat window, then to the minimum if still needed
+    Idx windows[] = { mKarereClient->historyResidentWindow(), 0 };
+    for (Idx window: windows)
+    {
+        for (auto& it: mChatForChatId)
+        {
+            Chat& chat = *it.second;
+            Idx keep = window ? window : (Idx)chat.initialHistoryFetchCount;
+            total -= chat.trimHistory(keep);
+            if (total <= cap)
+            {
+                return;
+            }
+        }
+    }
+    CHATD_LOG_WARNING("Messages in RAM (%zu) exceed the limit (%zu), history being viewed or fetched can't be evicted",
+                      total, cap);
+}
+
 bool Client::isMessageReceivedConfirmationActive() const
 {
     return mMessageReceivedConfirmation;
@@ -414,7 +449,7 @@ void Chat::connect()
     }
 }
 
-void Chat::login()
+void Chat::login(const ChatDbInfo* dbInfo)
 {
     assert(mConnection.isOnline());
     setOnlineState(kChatStateJoining);
@@ -422,7 +457,14 @@ void Chat::login()
     mServerOldHistCbEnabled = false;
 
     ChatDbInfo info;
-    mDbInterface->getHistoryInfo(info);
+    if (dbInfo)
+    {
+        info = *dbInfo;
+    }
+    else
+    {
+        mDbInterface->getHistoryInfo(info);
+    }
     mOldestKnownMsgId = info.oldestDbId;
 
     sendReactionSn();
@@ -488,7 +530,6 @@ void Connection::onSocketClose(int errcode, int errtype, const std::string& reas
 
     assert(oldState != kStateDisconnected);
 
-    usingipv6 = !usingipv6;
     mTargetIp.clear();
 
     if (oldState == kStateConnected)
@@ -661,6 +702,7 @@ void Connection::setState(State state)
     }
     else if (mState == kStateConnected)
     {
+        mTargetIp = wsConnectedIp();  // the IP that won the connection race
         CHATDS_LOG_DEBUG("Chatd connected to %s", mTargetIp.c_str());
 
         mDnsCache.connectDone(mShardNo, mTargetIp);
@@ -834,6 +876,7 @@ Promise<void> Connection::reconnect()
                 if (mDnsCache.isMatch(mShardNo, ipsv4, ipsv6))
                 {
                     CHATDS_LOG_DEBUG("DNS resolve matches cached IPs.");
+                    mDnsCache.setIp(mShardNo, ipsv4, ipsv6);  // refresh the full set of IPs and their age
                 }
                 else
                 {
@@ -905,56 +948,29 @@ void Connection::disconnect()
 
 void Connection::doConnect()
 {
-    string ipv4, ipv6;
-    bool cachedIPs = mDnsCache.getIp(mShardNo, ipv4, ipv6);
-    assert(cachedIPs);
-    mTargetIp = (usingipv6 && ipv6.size()) ? ipv6 : ipv4;
+    // race the cached IPv4 and IPv6 addresses, the first one to connect wins
+    std::vector<std::string> ips = mDnsCache.getIpsByPreference(mShardNo);
+    assert(ips.size());
+    mTargetIp = ips.front();
 
     const karere::Url &url = mDnsCache.getUrl(mShardNo);
     assert (url.isValid());
 
     setState(kStateConnecting);
-    CHATDS_LOG_DEBUG("Connecting to chatd using the IP: %s", mTargetIp.c_str());
+    CHATDS_LOG_DEBUG("Connecting to chatd using the IPs: %s %s", ips.front().c_str(), (ips.size() > 1) ? ips.back().c_str() : "");
 
-    bool rt = wsConnect(mChatdClient.mKarereClient->websocketIO, mTargetIp.c_str(),
+    if (!wsConnect(mChatdClient.mKarereClient->websocketIO, ips,
               url.host.c_str(),
               url.port,
               url.path.c_str(),
-              url.isSecure);
-
-    if (!rt)    // immediate failure --> try the other IP family (if available)
+              url.isSecure))
     {
         CHATDS_LOG_DEBUG("Connection to chatd failed using the IP: %s", mTargetIp.c_str());
-
-        string oldTargetIp = mTargetIp;
-        mTargetIp.clear();
-        if (oldTargetIp == ipv6 && ipv4.size())
-        {
-            mTargetIp = ipv4;
-        }
-        else if (oldTargetIp == ipv4 && ipv6.size())
-        {
-            mTargetIp = ipv6;
-        }
-
-        if (mTargetIp.size())
-        {
-            CHATDS_LOG_DEBUG("Retrying using the IP: %s", mTargetIp.c_str());
-            if (wsConnect(mChatdClient.mKarereClient->websocketIO, mTargetIp.c_str(),
-                                      url.host.c_str(),
-                                      url.port,
-                                      url.path.c_str(),
-                                      url.isSecure))
-            {
-                return;
-            }
-            CHATDS_LOG_DEBUG("Connection to chatd failed using the IP: %s", mTargetIp.c_str());
-        }
-        else
+        if (ips.size() == 1)
         {
             // do not close the socket, which forces a new retry attempt and turns the DNS response obsolete
             // Instead, let the DNS request to complete, in order to refresh IPs
-            CHATDS_LOG_DEBUG("Empty cached IP. Waiting for DNS resolution...");
+            CHATDS_LOG_DEBUG("No other cached IP. Waiting for DNS resolution...");
             return;
         }
 
@@ -1118,6 +1134,14 @@ void Client::retryPendingConnections(bool disconnect, bool refreshURL)
     }
 }
 
+void Client::persistUnreadCounts()
+{
+    for (auto& it: mChatForChatId)
+    {
+        it.second->persistUnreadCount();
+    }
+}
+
 void Client::heartbeat()
 {
     for (auto& conn: mConnections)
@@ -1131,6 +1155,51 @@ bool Connection::sendBuf(Buffer&& buf)
     if (!isOnline())
         return false;
 
+    if (mSendBatching)
+    {
+        if (mSendBatch.dataSize() && mSendBatch.dataSize() + buf.dataSize() > kMaxSendBatchSize)
+        {
+            flushSendBatch();   // commands never cross frame boundaries
+        }
+        if (!mSendBatch.buf())
+        {
+            mSendBatch.reserve(kMaxSendBatchSize);
+        }
+        mSendBatch.append(buf);
+        buf.free();
+        return true;
+    }
+
+    return sendFrame(std::move(buf));
+}
+
+void Connection::beginSendBatch()
+{
+    assert(!mSendBatching);
+    mSendBatching = true;
+}
+
+bool Connection::flushSendBatch()
+{
+    if (!mSendBatch.dataSize())
+        return true;
+
+    if (!isOnline())
+    {
+        mSendBatch.free();
+        return false;
+    }
+    return sendFrame(std::move(mSendBatch));
+}
+
+void Connection::endSendBatch()
+{
+    mSendBatching = false;
+    flushSendBatch();
+}
+
+bool Connection::sendFrame(Buffer&& buf)
+{
     // if several data are written to the output buffer to be sent all together, wait for all of them
     if (mSendPromise.done())
     {
@@ -1445,21 +1514,59 @@ string KeyCommand::toString() const
 // rejoin all open chats after reconnection (this is mandatory)
 bool Connection::rejoinExistingChats()
 {
+    if (mChatIds.empty())
+        return true;
+
+    InitStats& initStats = mChatdClient.mKarereClient->initStats();
+    initStats.shardStart(InitStats::kStatsJoinChats, shardNo());
+
+    // history info of all the chats in the shard, with a single query
+    std::map<karere::Id, ChatDbInfo> dbInfos;
+    try
+    {
+        // rows buffered by any chat in bulk mode must be in db before reading the whole shard
+        for (auto& chatid: mChatIds)
+        {
+            mChatdClient.chats(chatid).mDbInterface->flushBulkInsert();
+        }
+
+        Chat& chat = mChatdClient.chats(*mChatIds.begin());
+        chat.mDbInterface->getHistoryInfoOfShard(mShardNo, dbInfos);
+    }
+    catch(std::exception& e)
+    {
+        CHATDS_LOG_WARNING("rejoinExistingChats: failed to get history info of the shard, "
+                           "querying each chat: %s", e.what());
+        dbInfos.clear();
+    }
+
+    // JOIN/JOINRANGEHIST/REACTIONSN of all chats are packed in as few frames as possible
+    bool ok = true;
+    beginSendBatch();
     for (auto& chatid: mChatIds)
     {
         try
         {
             Chat& chat = mChatdClient.chats(chatid);
             if (!chat.isDisabled())
-                chat.login();
+            {
+                auto it = dbInfos.find(chatid);
+                chat.login((it != dbInfos.end()) ? &it->second : nullptr);
+            }
         }
         catch(std::exception& e)
         {
             CHATDS_LOG_ERROR("rejoinExistingChats: Exception: %s", e.what());
-            return false;
+            ok = false;
+            break;
         }
     }
-    return true;
+    endSendBatch();
+
+    initStats.shardEnd(InitStats::kStatsJoinChats, shardNo());
+    CHATDS_LOG_DEBUG("Sent login of %zu chats (%zu with history info from a single query)",
+                     mChatIds.size(), dbInfos.size());
+    return ok;
 }
 
 // send JOIN
@@ -1562,6 +1669,13 @@ HistSource Chat::getHistory(unsigned count)
         //start from newest message and go backwards
         mNextHistFetchIdx = highnum();
     }
+    mHistRequestHighnum = highnum();
+
+    if (mNextHistFetchIdx != CHATD_IDX_INVALID && mNextHistFetchIdx < lownum() - 1)
+    {
+        // messages already notified to the app were evicted, restore them before going on
+        reloadEvictedHistory(mNextHistFetchIdx + 1);
+    }
 
     Idx countSoFar = 0;
     if (mNextHistFetchIdx != CHATD_IDX_INVALID)
@@ -1775,6 +1889,12 @@ Chat::Chat(Connection& conn, Id chatid, Listener* listener,
     mLastReceivedId = info.lastRecvId;
     mLastSeenIdx = mDbInterface->getIdxOfMsgidFromHistory(mLastSeenId);
     mLastReceivedIdx = mDbInterface->getIdxOfMsgidFromHistory(mLastReceivedId);
+    mUnreadCountStored = mDbInterface->getUnreadCount(mUnreadCount);
+    mUnreadCountValid = mUnreadCountStored;
+    if (mUnreadCountStored && mLastSeenIdx == CHATD_IDX_INVALID)
+    {
+        invalidateUnreadCount();    // stored by older versions, see updateUnreadCount()
+    }
     std::string reactionSn = mDbInterface->getReactionSn();
     if (!reactionSn.empty())
     {
@@ -1803,12 +1923,21 @@ Chat::Chat(Connection& conn, Id chatid, Listener* listener,
         CHATID_LOG_DEBUG("Db has local history: %s - %s (middle point: %u)",
             ID_CSTR(info.oldestDbId), ID_CSTR(info.newestDbId), mForwardStart);
         loadAndProcessUnsent();
-        getHistoryFromDb(initialHistoryFetchCount); // ensure we have a minimum set of messages loaded and ready
+        if (mChatdClient.mKarereClient->lazyChatInit())
+        {
+            // defer it until the chat is used, history is paged in from db on demand anyway
+            mHistoryWindowPending = true;
+        }
+        else
+        {
+            getHistoryFromDb(initialHistoryFetchCount); // ensure we have a minimum set of messages loaded and ready
+        }
     }
 }
 Chat::~Chat()
 {
     CALL_LISTENER(onDestroy); //we don't delete because it may have its own idea of its lifetime (i.e. it could be a GUI class)
+    endDbBulkInsert();
     try { delete mCrypto; }
     catch(std::exception& e)
     { CHATID_LOG_ERROR("EXCEPTION from ICrypto destructor: %s", e.what()); }
@@ -1837,16 +1966,26 @@ void Chat::disable(bool state)
 Idx Chat::getHistoryFromDb(unsigned count)
 {
     assert(mHasMoreHistoryInDb); //we are within the db range
+    mHistoryWindowPending = false;
     std::vector<Message*> messages;
     CALL_DB(fetchDbHistory, lownum()-1, count, messages);
+
+    // Load reactions of the whole page from cache in a single query
+    std::map<karere::Id, ::mega::multimap<std::string, karere::Id>> reactions;
+    if (!messages.empty())
+    {
+        CALL_DB(getMessageReactionsInRange, lownum() - (Idx)messages.size(), lownum() - 1, reactions);
+    }
+
     for (auto msg: messages)
     {
-        // Load msg reactions from cache
-        ::mega::multimap<std::string, karere::Id> reactions;
-        CALL_DB(getMessageReactions, msg->id(), reactions);
-        for (auto &it : reactions)
+        auto itReactions = reactions.find(msg->id());
+        if (itReactions != reactions.end())
         {
-            msg->addReaction(it.first, it.second);
+            for (auto &it : itReactions->second)
+            {
+                msg->addReaction(it.first, it.second);
+            }
         }
 
         msgIncoming(false, msg, true); //increments mLastHistFetch/DecryptCount, may reset mHasMoreHistoryInDb if this msgid == mLastKnownMsgid
@@ -1866,6 +2005,8 @@ Idx Chat::getHistoryFromDb(unsigned count)
     // more unseen messages
     if ((messages.size() < count) && mHasMoreHistoryInDb)
         throw std::runtime_error(mChatId.toString()+": Db says it has no more messages, but we still haven't seen mOldestKnownMsgId of "+std::to_string((int64_t)mOldestKnownMsgId.val));
+
+    mChatdClient.trimHistory();
     return (Idx)messages.size();
 }
 
@@ -1885,6 +2026,16 @@ void Connection::wsHandleMsgCb(char *data, size_t len)
 {
     mTsLastRecv = time(NULL);
     execCommand(StaticBuffer(data, len));
+
+    for (karere::Id chatid: mChatsToFlush)
+    {
+        auto it = mChatdClient.mChatForChatId.find(chatid);
+        if (it != mChatdClient.mChatForChatId.end())
+        {
+            it->second->onCommandsProcessed();
+        }
+    }
+    mChatsToFlush.clear();
 }
 
 void Connection::wsSendMsgCb(const char *, size_t)
@@ -1916,7 +2067,7 @@ void Connection::execCommand(const StaticBuffer& buf)
         {
             case OP_KEEPALIVE:
             {
-                CHATDS_LOG_DEBUG("recv KEEPALIVE");
+                CHATDS_LOGD_DEBUG("recv KEEPALIVE");
                 sendKeepalive();
                 break;
             }
@@ -1935,8 +2086,8 @@ void Connection::execCommand(const StaticBuffer& buf)
                 READ_ID(userid, 8);
                 Priv priv = (Priv)buf.read<int8_t>(pos);
                 pos++;
-                CHATDS_LOG_DEBUG("%s: recv JOIN - user '%s' with privilege level %d",
-                                ID_CSTR(chatid), ID_CSTR(userid), priv);
+                CHATDS_LOGD_DEBUG("%s: recv JOIN - user '%s' with privilege level %d",
+                                chatid, userid, priv);
 
                 if (userid == Id::COMMANDER())
                 {
@@ -1966,9 +2117,9 @@ void Connection::execCommand(const StaticBuffer& buf)
                 const char* msgdata = buf.readPtr(pos, msglen);
                 pos += msglen;
 
-                CHATDS_LOG_DEBUG("%s: recv %s - msgid: '%s', from user '%s' with keyid %u, ts %u, tsdelta %u",
-                    ID_CSTR(chatid), Command::opcodeToStr(opcode), ID_CSTR(msgid),
-                    ID_CSTR(userid), keyid, ts, updated);
+                CHATDS_LOGD_DEBUG("%s: recv %s - msgid: '%s', from user '%s' with keyid %u, ts %u, tsdelta %u",
+                    chatid, LogStaticStr(Command::opcodeToStr(opcode)), msgid,
+                    userid, keyid, ts, updated);
 
                 std::unique_ptr<Message> msg(new Message(msgid, userid, ts, updated, msgdata, msglen, false, keyid));
                 msg->setEncrypted(Message::kEncryptedPending);
@@ -1994,7 +2145,7 @@ void Connection::execCommand(const StaticBuffer& buf)
             {
                 READ_CHATID(0);
                 READ_ID(msgid, 8);
-                CHATDS_LOG_DEBUG("%s: recv SEEN - msgid: '%s'", ID_CSTR(chatid), ID_CSTR(msgid));
+                CHATDS_LOGD_DEBUG("%s: recv SEEN - msgid: '%s'", chatid, msgid);
                 mChatdClient.chats(chatid).onLastSeen(msgid);
                 break;
             }
@@ -2002,7 +2153,7 @@ void Connection::execCommand(const StaticBuffer& buf)
             {
                 READ_CHATID(0);
                 READ_ID(msgid, 8);
-                CHATDS_LOG_DEBUG("%s: recv RECEIVED - msgid: '%s'", ID_CSTR(chatid), ID_CSTR(msgid));
+                CHATDS_LOGD_DEBUG("%s: recv RECEIVED - msgid: '%s'", chatid, msgid);
                 mChatdClient.chats(chatid).onLastReceived(msgid);
                 break;
             }
@@ -2019,7 +2170,7 @@ void Connection::execCommand(const StaticBuffer& buf)
             {
                 READ_ID(msgxid, 0);
                 READ_ID(msgid, 8);
-                CHATDS_LOG_DEBUG("recv MSGID: '%s' -> '%s'", ID_CSTR(msgxid), ID_CSTR(msgid));
+                CHATDS_LOGD_DEBUG("recv MSGID: '%s' -> '%s'", msgxid, msgid);
                 mChatdClient.onMsgAlreadySent(msgxid, msgid);
                 break;
             }
@@ -2027,7 +2178,7 @@ void Connection::execCommand(const StaticBuffer& buf)
             {
                 READ_ID(msgxid, 0);
                 READ_ID(msgid, 8);
-                CHATDS_LOG_DEBUG("recv NEWMSGID: '%s' -> '%s'", ID_CSTR(msgxid), ID_CSTR(msgid));
+                CHATDS_LOGD_DEBUG("recv NEWMSGID: '%s' -> '%s'", msgxid, msgid);
                 mChatdClient.msgConfirm(msgxid, msgid);
                 break;
             }
@@ -2121,7 +2272,7 @@ void Connection::execCommand(const StaticBuffer& buf)
                 READ_CHATID(0);
                 READ_32(keyxid, 8);
                 READ_32(keyid, 12);
-                CHATDS_LOG_DEBUG("%s: recv NEWKEYID: %u -> %u", ID_CSTR(chatid), keyxid, keyid);
+                CHATDS_LOGD_DEBUG("%s: recv NEWKEYID: %u -> %u", chatid, keyxid, keyid);
                 mChatdClient.chats(chatid).keyConfirm(keyxid, keyid);
                 break;
             }
@@ -2132,7 +2283,7 @@ void Connection::execCommand(const StaticBuffer& buf)
                 READ_32(totalLen, 12);
                 const char* keys = buf.readPtr(pos, totalLen);
                 pos+=totalLen;
-                CHATDS_LOG_DEBUG("%s: recv NEWKEY %u", ID_CSTR(chatid), keyid);
+                CHATDS_LOGD_DEBUG("%s: recv NEWKEY %u", chatid, keyid);
                 mChatdClient.chats(chatid).onNewKeys(StaticBuffer(keys, totalLen));
                 break;
             }
@@ -2238,7 +2389,7 @@ void Connection::execCommand(const StaticBuffer& buf)
             }
             case OP_ECHO:
             {
-                CHATDS_LOG_DEBUG("recv ECHO");
+                CHATDS_LOGD_DEBUG("recv ECHO");
                 if (mEchoTimer)
                 {
                     CHATDS_LOG_DEBUG("Socket is still alive");
@@ -2326,7 +2477,7 @@ void Connection::execCommand(const StaticBuffer& buf)
                 READ_ID(msgxid, 0);
                 READ_ID(msgid, 8);
                 READ_32(timestamp, 16);
-                CHATDS_LOG_DEBUG("recv MSGIDTIMESTAMP: '%s' -> '%s'  %d", ID_CSTR(msgxid), ID_CSTR(msgid), timestamp);
+                CHATDS_LOGD_DEBUG("recv MSGIDTIMESTAMP: '%s' -> '%s'  %d", msgxid, msgid, timestamp);
                 mChatdClient.onMsgAlreadySent(msgxid, msgid);
                 break;
             }
@@ -2335,7 +2486,7 @@ void Connection::execCommand(const StaticBuffer& buf)
                 READ_ID(msgxid, 0);
                 READ_ID(msgid, 8);
                 READ_32(timestamp, 16);
-                CHATDS_LOG_DEBUG("recv NEWMSGIDTIMESTAMP: '%s' -> '%s'   %d", ID_CSTR(msgxid), ID_CSTR(msgid), timestamp);
+                CHATDS_LOGD_DEBUG("recv NEWMSGIDTIMESTAMP: '%s' -> '%s'   %d", msgxid, msgid, timestamp);
                 mChatdClient.msgConfirm(msgxid, msgid, timestamp);
                 break;
             }
@@ -2448,6 +2599,10 @@ void Chat::onFetchHistDone()
             mHaveAllHistory = true;
             mAttachmentNodes->setHaveAllHistory(true);
             CALL_DB(setHaveAllHistory, true);
+            if (mLastSeenIdx == CHATD_IDX_INVALID && mUnreadCount < 0)
+            {
+                mUnreadCount = -mUnreadCount;   // the count is not negative anymore
+            }
             CHATID_LOG_DEBUG("Start of history reached");
             //last text msg stuff
             if (mLastTextMsg.isFetching())
@@ -2480,6 +2635,8 @@ void Chat::onFetchHistDone()
         CHATID_LOG_DEBUG("No text message seen yet, fetching more history from server");
         getHistory(initialHistoryFetchCount);
     }
+
+    mChatdClient.trimHistory();
 }
 
 void Chat::loadAndProcessUnsent()
@@ -2608,14 +2765,15 @@ void Chat::addReaction(const Message &message, const std::string &reaction)
         if (wptr.deleted())
             return;
 
+        karere::Id msgid = message.id();
         mCrypto->reactionEncrypt(message, reaction)
-        .then([this, wptr, &message](std::shared_ptr<Buffer> data)
+        .then([this, wptr, msgid](std::shared_ptr<Buffer> data)
         {
             if (wptr.deleted())
                 return;
 
            std::string encReaction (data->buf(), data->bufSize());  // lenght must be only 1 byte. passing the buffer uses 4 bytes for size
-           sendCommand(Command(OP_ADDREACTION) + mChatId + client().myHandle() + message.id() + (int8_t)data->bufSize() + encReaction);
+           sendCommand(Command(OP_ADDREACTION) + mChatId + client().myHandle() + msgid + (int8_t)data->bufSize() + encReaction);
         })
         .fail([this](const ::promise::Error& err)
         {
@@ -2627,19 +2785,20 @@ void Chat::addReaction(const Message &message, const std::string &reaction)
 void Chat::delReaction(const Message &message, const std::string &reaction)
 {
     auto wptr = weakHandle();
-    marshallCall([wptr, this, &message, reaction]()
+    marshallCall([wptr, this, message, reaction]()
     {
         if (wptr.deleted())
             return;
 
+        karere::Id msgid = message.id();
         mCrypto->reactionEncrypt(message, reaction)
-        .then([this, wptr, &message](std::shared_ptr<Buffer> data)
+        .then([this, wptr, msgid](std::shared_ptr<Buffer> data)
         {
             if (wptr.deleted())
                 return;
 
            std::string encReaction (data->buf(), data->bufSize());  // lenght must be only 1 byte. passing the buffer uses 4 bytes for size
-           sendCommand(Command(OP_DELREACTION) + mChatId + client().myHandle() + message.id() + (int8_t)data->bufSize() + encReaction);
+           sendCommand(Command(OP_DELREACTION) + mChatId + client().myHandle() + msgid + (int8_t)data->bufSize() + encReaction);
         })
         .fail([this](const ::promise::Error& err)
         {
@@ -2729,8 +2888,11 @@ void Chat::initChat()
 
     mOldestKnownMsgId = 0;
     mLastSeenIdx = CHATD_IDX_INVALID;
+    invalidateUnreadCount();
     mLastReceivedIdx = CHATD_IDX_INVALID;
     mNextHistFetchIdx = CHATD_IDX_INVALID;
+    mHistRequestHighnum = CHATD_IDX_INVALID;
+    mOldestEvictedIdx = CHATD_IDX_INVALID;
     mLastIdReceivedFromServer = 0;
     mLastIdxReceivedFromServer = CHATD_IDX_INVALID;
     mLastServerHistFetchCount = 0;
@@ -2740,9 +2902,13 @@ void Chat::initChat()
     mEncryptionHalted = false;
     mDecryptNewHaltedAt = CHATD_IDX_INVALID;
     mDecryptOldHaltedAt = CHATD_IDX_INVALID;
+    mDecryptNewDeferred = false;
+    mDecryptOldDeferred = false;
+    mDecryptAheadQueue.clear();
     mRefidToIdxMap.clear();
 
     mHasMoreHistoryInDb = false;
+    mHistoryWindowPending = false;
     mHaveAllHistory = false;
 }
 
@@ -3018,6 +3184,9 @@ void Chat::createMsgBackRefs(Chat::OutputQueue::iterator msgit)
 
     static std::random_device rd;
 
+    // backrefs are picked from the RAM history buffer
+    loadHistoryWindow();
+
     // mSending is a list, so we don't have random access by index there.
     // Therefore, we copy the relevant part of it to a vector
     std::vector<SendingItem*> sendingIdx;
@@ -3527,6 +3696,7 @@ void Chat::onLastSeen(Id msgid, bool resend)
     CHATID_LOG_DEBUG("setMessageSeen: Setting last seen msgid to %s", ID_CSTR(msgid));
     mLastSeenId = msgid;
     CALL_DB(setLastSeen, msgid);
+    updateUnreadCountOnSeen(mLastSeenIdx, idx);
 
     if (idx != CHATD_IDX_INVALID)   // if msgid is known locally, notify the unread count
     {
@@ -3592,6 +3762,7 @@ bool Chat::setMessageSeen(Idx idx)
             Idx lowest = lownum()-1;
             notifyStart = (mLastSeenIdx < lowest) ? lowest : mLastSeenIdx;
         }
+        updateUnreadCountOnSeen(mLastSeenIdx, idx);
         mLastSeenIdx = idx;
         Idx highest = highnum();
         Idx notifyEnd = (mLastSeenIdx > highest) ? highest : mLastSeenIdx;
@@ -3616,16 +3787,46 @@ bool Chat::setMessageSeen(Idx idx)
 
 bool Chat::setMessageSeen(Id msgid)
 {
-    auto it = mIdToIndexMap.find(msgid);
-    if (it == mIdToIndexMap.end())
+    Idx idx = msgIndexFromIdOrDb(msgid);
+    if (idx == CHATD_IDX_INVALID)
     {
         CHATID_LOG_WARNING("setMessageSeen: unknown msgid '%s'", ID_CSTR(msgid));
         return false;
     }
-    return setMessageSeen(it->second);
+    return setMessageSeen(idx);
 }
 
 int Chat::unreadMsgCount() const
+{
+    if (mUnreadCountValid)
+    {
+#ifndef NDEBUG
+        int count = computeUnreadMsgCount();
+        if (count != mUnreadCount)
+        {
+            CHATID_LOG_ERROR("unreadMsgCount: cached count %d doesn't match the actual count %d", mUnreadCount, count);
+            assert(false);
+        }
+#endif
+        return mUnreadCount;
+    }
+
+    mUnreadCount = computeUnreadMsgCount();
+    mUnreadCountValid = true;   // stored later, see persistUnreadCount()
+    return mUnreadCount;
+}
+
+void Chat::persistUnreadCount()
+{
+    // without last-seen pointer, the count depends on the history fetched so far
+    if (!mUnreadCountValid || mUnreadCountStored || mLastSeenIdx == CHATD_IDX_INVALID)
+        return;
+
+    mUnreadCountStored = true;
+    CALL_DB(setUnreadCount, mUnreadCount);
+}
+
+int Chat::computeUnreadMsgCount() const
 {
     if (mLastSeenIdx == CHATD_IDX_INVALID)
     {
@@ -3658,6 +3859,60 @@ int Chat::unreadMsgCount() const
     return count;
 }
 
+void Chat::updateUnreadCount(int delta)
+{
+    if (!mUnreadCountValid || !delta)
+        return;
+
+    if (mLastSeenIdx == CHATD_IDX_INVALID && !mHaveAllHistory)
+    {
+        // negative while the start of history is not reached, see unreadMsgCount()
+        delta = -delta;
+    }
+    mUnreadCount += delta;
+    setUnreadCountChanged();
+}
+
+void Chat::updateUnreadCountOnSeen(Idx oldIdx, Idx newIdx)
+{
+    if (!mUnreadCountValid)
+        return;
+
+    // messages that became seen must be in RAM, otherwise recompute on demand
+    if (oldIdx == CHATD_IDX_INVALID || newIdx == CHATD_IDX_INVALID
+            || oldIdx + 1 < lownum() || newIdx > highnum())
+    {
+        invalidateUnreadCount();
+        return;
+    }
+
+    int seen = 0;
+    for (Idx i = oldIdx + 1; i <= newIdx; i++)
+    {
+        if (at(i).isValidUnread(mChatdClient.myHandle()))
+        {
+            seen++;
+        }
+    }
+    updateUnreadCount(-seen);
+}
+
+void Chat::invalidateUnreadCount()
+{
+    mUnreadCountValid = false;
+    setUnreadCountChanged();
+}
+
+void Chat::setUnreadCountChanged() const
+{
+    if (!mUnreadCountStored)
+        return;
+
+    // so an outdated count is never loaded, i.e. if the app is killed before it's persisted
+    mUnreadCountStored = false;
+    CALL_DB(invalidateUnreadCount);
+}
+
 void Chat::flushOutputQueue(bool fromStart)
 {
     if (!isLoggedIn())
@@ -3859,6 +4114,7 @@ Idx Chat::msgConfirm(Id msgxid, Id msgid, uint32_t timestamp)
     assert(!msg->isLocalKeyid());
 
     // add message to history
+    msg->moveToArena(mPayloadArena);
     push_forward(msg);
     auto idx = mIdToIndexMap[msgid] = highnum();
     if (msg->type == Message::kMsgAttachment)
@@ -4173,6 +4429,12 @@ void Chat::onMsgUpdatedAfterDecrypt(time_t updateTs, bool richLinkRemoved, Messa
             msg->type = msg->buf()[1] + Message::Type::kMsgOffset;
     }
 
+    if (mNextHistFetchIdx != CHATD_IDX_INVALID)
+    {
+        // the app may have the message even if it was evicted from RAM, so restore it to notify the update
+        msgIndexFromIdOrDb(msg->id());
+    }
+
     //update in memory, if loaded
     auto msgit = mIdToIndexMap.find(msg->id());
     Idx idx;
@@ -4210,6 +4472,10 @@ void Chat::onMsgUpdatedAfterDecrypt(time_t updateTs, bool richLinkRemoved, Messa
         //update in db
         CALL_DB(updateMsgInHistory, msg->id(), *msg);
 
+        // a message still pending to decrypt will be counted by msgIncomingAfterDecrypt()
+        bool wasUnread = histmsg.isValidUnread(client().myHandle());
+        bool wasPending = histmsg.isPendingToDecrypt();
+
         // update in RAM
         histmsg.assign(*msg);     // content
         histmsg.updated = msg->updated;
@@ -4222,6 +4488,15 @@ void Chat::onMsgUpdatedAfterDecrypt(time_t updateTs, bool richLinkRemoved, Messa
             histmsg.keyid = msg->keyid;
         }
 
+        if (wasPending)
+        {
+            invalidateUnreadCount();
+        }
+        else if (mLastSeenIdx == CHATD_IDX_INVALID || idx > mLastSeenIdx)
+        {
+            updateUnreadCount((int)histmsg.isValidUnread(client().myHandle()) - (int)wasUnread);
+        }
+
         if (idx > mNextHistFetchIdx)
         {
             // msg.ts is zero - chatd doesn't send the original timestamp
@@ -4279,6 +4554,7 @@ void Chat::onMsgUpdatedAfterDecrypt(time_t updateTs, bool richLinkRemoved, Messa
         {
             //update in db
             CALL_DB(updateMsgInHistory, msg->id(), *msg);
+            invalidateUnreadCount();
         }
 
         if (msg->isDeleted()) // previous type is unknown, so cannot check for attachment type here
@@ -4306,6 +4582,7 @@ void Chat::handleTruncate(const Message& msg, Idx idx)
     CHATID_LOG_DEBUG("Truncating chat history before msgid %s, idx %d, fwdStart %d", ID_CSTR(msg.id()), idx, mForwardStart);
     CALL_CRYPTO(resetSendKey);      // discard current key, if any
     CALL_DB(truncateHistory, msg);
+    invalidateUnreadCount();
     if (idx != CHATD_IDX_INVALID)   // message is loaded in RAM
     {
         //GUI must detach and free any resources associated with
@@ -4313,6 +4590,7 @@ void Chat::handleTruncate(const Message& msg, Idx idx)
         CALL_LISTENER(onHistoryTruncated, msg, idx);
 
         deleteMessagesBefore(idx);
+        mOldestEvictedIdx = CHATD_IDX_INVALID;  // evicted messages were truncated too
         removePendingRichLinks(idx);
         removeMessageReactions(idx);
 
@@ -4402,6 +4680,133 @@ void Chat::deleteMessagesBefore(Idx idx)
     }
 }
 
+Idx Chat::trimHistory(Idx keep)
+{
+    if (keep <= 0 || size() <= keep
+            || mServerFetchState != kHistNotFetching
+            || mDecryptOldHaltedAt != CHATD_IDX_INVALID
+            || mDecryptNewHaltedAt != CHATD_IDX_INVALID)
+    {
+        return 0;
+    }
+
+    Idx newLow = highnum() - keep + 1;
+    if (mNextHistFetchIdx != CHATD_IDX_INVALID && mNextHistFetchIdx < newLow - 1
+            && mHistRequestHighnum != CHATD_IDX_INVALID && highnum() - mHistRequestHighnum < keep)
+    {
+        // the app has recently loaded older messages and may be viewing them. Once
+        // enough new messages are received, they're out of the visible window
+        newLow = mNextHistFetchIdx + 1;
+    }
+    if (newLow <= lownum())
+    {
+        return 0;
+    }
+
+    // only messages already saved to db can be evicted
+    for (Idx i = lownum(); i < newLow; i++)
+    {
+        if (at(i).isPendingToDecrypt())
+        {
+            return 0;
+        }
+    }
+
+    for (Idx i = lownum(); i < newLow; i++)
+    {
+        const Message& msg = at(i);
+        mIdToIndexMap.erase(msg.id());
+        auto it = mRefidToIdxMap.find(msg.backRefId);
+        if (msg.backRefId && it != mRefidToIdxMap.end() && it->second == i)
+        {
+            mRefidToIdxMap.erase(it);
+        }
+    }
+
+    Idx count = newLow - lownum();
+    mOldestEvictedIdx = std::min(mOldestEvictedIdx, lownum());
+    deleteMessagesBefore(newLow);
+    mHasMoreHistoryInDb = true;
+    CHATID_LOG_DEBUG("Evicted %d messages from RAM, oldest idx in RAM: %d", count, lownum());
+    return count;
+}
+
+void Chat::reloadEvictedHistory(Idx idx) const
+{
+    if (mOldestEvictedIdx == CHATD_IDX_INVALID || idx < mOldestEvictedIdx || idx >= lownum())
+    {
+        return;
+    }
+
+    std::vector<Message*> messages;
+    CALL_DB(fetchDbHistory, lownum() - 1, lownum() - idx, messages);
+
+    std::map<karere::Id, ::mega::multimap<std::string, karere::Id>> reactions;
+    if (!messages.empty())
+    {
+        CALL_DB(getMessageReactionsInRange, lownum() - (Idx)messages.size(), lownum() - 1, reactions);
+    }
+
+    // these messages were already processed when received, so they are only restored in RAM
+    for (auto msg: messages)
+    {
+        auto itReactions = reactions.find(msg->id());
+        if (itReactions != reactions.end())
+        {
+            for (auto &it : itReactions->second)
+            {
+                msg->addReaction(it.first, it.second);
+            }
+        }
+
+        msg->moveToArena(mPayloadArena);
+        mBackwardList.emplace_back(msg);
+        Idx msgIdx = lownum();
+        mIdToIndexMap[msg->id()] = msgIdx;
+        if (msg->backRefId)
+        {
+            mRefidToIdxMap.emplace(msg->backRefId, msgIdx);
+        }
+        if (msg->id() == mOldestKnownMsgId)
+        {
+            mHasMoreHistoryInDb = false;
+        }
+    }
+
+    if (lownum() <= mOldestEvictedIdx)
+    {
+        mOldestEvictedIdx = CHATD_IDX_INVALID;
+    }
+    CHATID_LOG_DEBUG("Reloaded %zu evicted messages from db, oldest idx in RAM: %d", messages.size(), lownum());
+}
+
+Idx Chat::msgIndexFromIdOrDb(karere::Id msgid)
+{
+    Idx idx = msgIndexFromId(msgid);
+    if (idx == CHATD_IDX_INVALID && mOldestEvictedIdx != CHATD_IDX_INVALID)
+    {
+        Idx dbIdx = mDbInterface->getIdxOfMsgidFromHistory(msgid);
+        if (dbIdx != CHATD_IDX_INVALID && findOrNull(dbIdx))
+        {
+            idx = dbIdx;
+        }
+    }
+    return idx;
+}
+
+void Chat::loadHistoryWindow()
+{
+    if (!mHistoryWindowPending)
+        return;
+
+    mHistoryWindowPending = false;
+    if (!mHasMoreHistoryInDb)
+        return;
+
+    CHATID_LOG_DEBUG("Loading deferred history window from db");
+    getHistoryFromDb(initialHistoryFetchCount);
+}
+
 Message::Status Chat::getMsgStatus(const Message& msg, Idx idx) const
 {
     assert(idx != CHATD_IDX_INVALID);
@@ -4450,6 +4855,11 @@ Idx Chat::msgIncoming(bool isNew, Message* message, bool isLocal)
     assert(msgid);
     Idx idx;
 
+    if (!isLocal && isFetchingFromServer())
+    {
+        beginDbBulkInsert();    // OLDMSG page or JOINRANGEHIST burst
+    }
+
     if (isNew)
     {
         auto it = mIdToIndexMap.find(message->id());
@@ -4503,6 +4913,21 @@ Idx Chat::msgIncoming(bool isNew, Message* message, bool isLocal)
     }
     mIdToIndexMap[msgid] = idx;
     handleLastReceivedSeen(msgid);
+
+    Idx& haltedAt = isNew ? mDecryptNewHaltedAt : mDecryptOldHaltedAt;
+    if (!isLocal && haltedAt == CHATD_IDX_INVALID
+            && mServerFetchState == (isNew ? kHistFetchingNewFromServer : kHistFetchingOldFromServer)
+            && idx >= lownum() && idx <= highnum())
+    {
+        // first message of a history page: halt until the whole page is received, so it's
+        // verified and decrypted by the workers as a batch, and resume in order from here
+        CHATID_LOG_DEBUG("Decryption deferred until the history page is received");
+        haltedAt = idx;
+        (isNew ? mDecryptNewDeferred : mDecryptOldDeferred) = true;
+        queueDecryptAhead(idx);
+        return idx;
+    }
+
     msgIncomingAfterAdd(isNew, isLocal, *message, idx);
     return idx;
 }
@@ -4591,6 +5016,7 @@ bool Chat::msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx)
         if (mDecryptNewHaltedAt != CHATD_IDX_INVALID)
         {
             CHATID_LOG_DEBUG("Decryption of new messages is halted, message queued for decryption");
+            queueDecryptAhead(idx);   // decryption can progress in background meanwhile
             return false;
         }
     }
@@ -4599,6 +5025,7 @@ bool Chat::msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx)
         if (mDecryptOldHaltedAt != CHATD_IDX_INVALID)
         {
             CHATID_LOG_DEBUG("Decryption of old messages is halted, message queued for decryption");
+            queueDecryptAhead(idx);   // decryption can progress in background meanwhile
             return false;
         }
     }
@@ -4666,54 +5093,20 @@ bool Chat::msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx)
         else
             assert(mDecryptOldHaltedAt == idx);
 #endif
-        msgIncomingAfterDecrypt(isNew, false, *message, idx);
-        if (isNew)
+        // the queued messages of a page are written to db at once
+        bool bulkInsert = isFetchingFromServer() && !mDbBulkInsert;
+        if (bulkInsert)
         {
-            // Decrypt the rest - try to decrypt immediately (synchromously),
-            // so that order is guaranteed. Bail out of the loop at the first
-            // message that can't be decrypted immediately(msgIncomingAfterAdd()
-            // returns false). Will continue when the delayed decrypt finishes
-
-            auto first = mDecryptNewHaltedAt + 1;
-            mDecryptNewHaltedAt = CHATD_IDX_INVALID;
-            auto last = highnum();
-            for (Idx i = first; i <= last; i++)
-            {
-                if (!msgIncomingAfterAdd(isNew, false, at(i), i))
-                    break;
-            }
-            if ((mServerFetchState == kHistDecryptingNew) &&
-                (mDecryptNewHaltedAt == CHATD_IDX_INVALID)) //all messages decrypted
-            {
-                mServerFetchState = kHistNotFetching;
-            }
+            beginDbBulkInsert();
         }
-        else
+
+        msgIncomingAfterDecrypt(isNew, false, *message, idx);
+        assert(isNew || !isLocal); // local messages are always decrypted, this is handled at the start of this func
+        resumeDecrypt(isNew, isNew ? idx + 1 : idx - 1);
+
+        if (bulkInsert)
         {
-            // Old history
-            // Decrypt the rest synchronously, bail out on first that can't
-            // decrypt synchonously.
-            // Local messages are always decrypted, this is handled
-            // at the start of this func
-
-            assert(!isLocal);
-            auto first = mDecryptOldHaltedAt - 1;
-            mDecryptOldHaltedAt = CHATD_IDX_INVALID;
-            auto last = lownum();
-            for (Idx i = first; i >= last; i--)
-            {
-                if (!msgIncomingAfterAdd(isNew, false, at(i), i))
-                    break;
-            }
-            if ((mServerFetchState == kHistDecryptingOld) &&
-                (mDecryptOldHaltedAt == CHATD_IDX_INVALID))
-            {
-                mServerFetchState = kHistNotFetching;
-                if (mServerOldHistCbEnabled)
-                {
-                    CALL_LISTENER(onHistoryDone, kHistSourceServer);
-                }
-            }
+            endDbBulkInsert();
         }
     })
     .fail([this, message](const ::promise::Error& err)
@@ -4736,6 +5129,129 @@ bool Chat::msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx)
     return false; //decrypt was not done immediately
 }
 
+// Decrypts the messages from \c first onwards (backwards for old history), synchronously so
+// that order is guaranteed. Bails out at the first message that can't be decrypted immediately
+// (msgIncomingAfterAdd() returns false), which halts decryption again until it's decrypted.
+void Chat::resumeDecrypt(bool isNew, Idx first)
+{
+    if (isNew)
+    {
+        mDecryptNewHaltedAt = CHATD_IDX_INVALID;
+        auto last = highnum();
+        for (Idx i = first; i <= last; i++)
+        {
+            if (!msgIncomingAfterAdd(isNew, false, at(i), i))
+                break;
+        }
+        if ((mServerFetchState == kHistDecryptingNew) &&
+            (mDecryptNewHaltedAt == CHATD_IDX_INVALID)) //all messages decrypted
+        {
+            mServerFetchState = kHistNotFetching;
+        }
+    }
+    else
+    {
+        mDecryptOldHaltedAt = CHATD_IDX_INVALID;
+        auto last = lownum();
+        for (Idx i = first; i >= last; i--)
+        {
+            if (!msgIncomingAfterAdd(isNew, false, at(i), i))
+                break;
+        }
+        if ((mServerFetchState == kHistDecryptingOld) &&
+            (mDecryptOldHaltedAt == CHATD_IDX_INVALID))
+        {
+            mServerFetchState = kHistNotFetching;
+            if (mServerOldHistCbEnabled)
+            {
+                CALL_LISTENER(onHistoryDone, kHistSourceServer);
+            }
+        }
+    }
+}
+
+// Defer the decryption of the message so it's batched with the rest of the received frame
+void Chat::queueDecryptAhead(Idx idx)
+{
+    mDecryptAheadQueue.push_back(idx);
+    mConnection.mChatsToFlush.insert(mChatId);
+}
+
+void Chat::flushDecryptAhead()
+{
+    std::vector<Message*> msgs;
+    msgs.reserve(mDecryptAheadQueue.size());
+    for (Idx idx: mDecryptAheadQueue)
+    {
+        // the history may have been truncated or reloaded meanwhile
+        if (idx >= lownum() && idx <= highnum() && at(idx).isPendingToDecrypt())
+        {
+            msgs.push_back(&at(idx));
+        }
+    }
+    mDecryptAheadQueue.clear();
+
+    if (!msgs.empty())
+    {
+        mCrypto->verifyBatch(msgs);
+    }
+
+    // the workers may still be verifying the page: the loop halts at the first message
+    // whose result isn't ready, and continues when it is
+    if (mDecryptNewDeferred)
+    {
+        mDecryptNewDeferred = false;
+        if (mDecryptNewHaltedAt != CHATD_IDX_INVALID)
+        {
+            resumeDecrypt(true, mDecryptNewHaltedAt);
+        }
+    }
+    if (mDecryptOldDeferred)
+    {
+        mDecryptOldDeferred = false;
+        if (mDecryptOldHaltedAt != CHATD_IDX_INVALID)
+        {
+            resumeDecrypt(false, mDecryptOldHaltedAt);
+        }
+    }
+}
+
+void Chat::beginDbBulkInsert()
+{
+    if (mDbBulkInsert)
+    {
+        return;
+    }
+    mDbBulkInsert = true;
+    CALL_DB(beginBulkInsert);
+    // in case it's not ended explicitly, it's ended with the frame being processed
+    mConnection.mChatsToFlush.insert(mChatId);
+}
+
+void Chat::endDbBulkInsert()
+{
+    if (!mDbBulkInsert)
+    {
+        return;
+    }
+    mDbBulkInsert = false;
+    persistUnreadCount();   // in the same transaction as the page
+    CALL_DB(endBulkInsert);
+}
+
+void Chat::onCommandsProcessed()
+{
+    flushDecryptAhead();
+    endDbBulkInsert();  // commit once per received page
+
+    // with some slack, so the buffer is not trimmed for every new message
+    Idx window = mChatdClient.mKarereClient->historyResidentWindow();
+    if (window && size() > window + window / 4)
+    {
+        trimHistory(window);
+    }
+}
+
 // Save to history db, handle received and seen pointers, call new/old message user callbacks
 void Chat::msgIncomingAfterDecrypt(bool isNew, bool isLocal, Message& msg, Idx idx)
 {
@@ -4744,6 +5260,10 @@ void Chat::msgIncomingAfterDecrypt(bool isNew, bool isLocal, Message& msg, Idx i
     {
         mLastHistDecryptCount++;
     }
+    if (idx >= lownum() && idx <= highnum()) // not a server history msg that is only stored in db
+    {
+        msg.moveToArena(mPayloadArena);
+    }
     auto msgid = msg.id();
     if (!isLocal)
     {
@@ -4811,6 +5331,12 @@ void Chat::msgIncomingAfterDecrypt(bool isNew, bool isLocal, Message& msg, Idx i
         }
     }
 
+    if (!isLocal && (mLastSeenIdx == CHATD_IDX_INVALID || idx > mLastSeenIdx)
+            && msg.isValidUnread(mChatdClient.myHandle()))
+    {
+        updateUnreadCount(1);
+    }
+
     if (isNew || (mLastSeenIdx == CHATD_IDX_INVALID))
         CALL_LISTENER(onUnreadChanged);
 
@@ -4999,7 +5525,7 @@ void Chat::onUserLeave(Id userid)
 
 void Chat::onAddReaction(Id msgId, Id userId, std::string reaction)
 {
-    Idx messageIdx = msgIndexFromId(msgId);
+    Idx messageIdx = msgIndexFromIdOrDb(msgId);
     if (messageIdx == CHATD_IDX_INVALID)
     {
         CHATID_LOG_WARNING("onAddReaction: message id not found. msgid: %s", ID_CSTR(msgId));
@@ -5021,11 +5547,17 @@ void Chat::onAddReaction(Id msgId, Id userId, std::string reaction)
 
     auto wptr = weakHandle();
     mCrypto->reactionDecrypt(message, reaction)
-    .then([this, wptr, &message, userId](std::shared_ptr<Buffer> data)   // data is the UTF-8 string (the emoji)
+    .then([this, wptr, msgId, userId](std::shared_ptr<Buffer> data)   // data is the UTF-8 string (the emoji)
     {
         if (wptr.deleted())
             return;
 
+        // the message may have been evicted from RAM while decrypting
+        Message* msg = findOrNull(msgIndexFromIdOrDb(msgId));
+        if (!msg)
+            return;
+
+        Message& message = *msg;
         const std::string reaction(data->buf(), data->size());
         message.addReaction(reaction, userId);
         CALL_DB(addReaction, message.mId, userId, reaction.c_str());
@@ -5040,7 +5572,7 @@ void Chat::onAddReaction(Id msgId, Id userId, std::string reaction)
 
 void Chat::onDelReaction(Id msgId, Id userId, std::string reaction)
 {
-    Idx messageIdx = msgIndexFromId(msgId);
+    Idx messageIdx = msgIndexFromIdOrDb(msgId);
     if (messageIdx == CHATD_IDX_INVALID)
     {
         CHATID_LOG_WARNING("onDelReaction: message id not found. msgid: %s)", ID_CSTR(msgId));
@@ -5062,11 +5594,17 @@ void Chat::onDelReaction(Id msgId, Id userId, std::string reaction)
 
     auto wptr = weakHandle();
     mCrypto->reactionDecrypt(message, reaction)
-    .then([this, wptr, &message, userId](std::shared_ptr<Buffer> data)
+    .then([this, wptr, msgId, userId](std::shared_ptr<Buffer> data)
     {
         if (wptr.deleted())
             return;
 
+        // the message may have been evicted from RAM while decrypting
+        Message* msg = findOrNull(msgIndexFromIdOrDb(msgId));
+        if (!msg)
+            return;
+
+        Message& message = *msg;
         const std::string reaction(data->buf(), data->bufSize());
         message.delReaction(reaction, userId);
 
@@ -5128,6 +5666,7 @@ void Chat::onJoinComplete()
 void Chat::resetGetHistory()
 {
     mNextHistFetchIdx = CHATD_IDX_INVALID;
+    mHistRequestHighnum = CHATD_IDX_INVALID;
     mServerOldHistCbEnabled = false;
 }
 
@@ -5255,7 +5794,10 @@ bool Chat::findLastTextMsg()
                 return true;
             }
         }
-        //check in db
+    }
+    if (!empty() || mHasMoreHistoryInDb)
+    {
+        //check in db (RAM may be empty if the history window hasn't been loaded yet)
         CALL_DB(getLastTextMessage, lownum()-1, mLastTextMsg, mLastMsgTs);
         if (mLastTextMsg.isValid())
         {
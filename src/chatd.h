@@ -27,6 +27,7 @@ class MyMegaApi;
 #define CHATD_LOG_INFO(fmtString,...) KARERE_LOG_INFO(krLogChannel_chatd, fmtString, ##__VA_ARGS__)
 #define CHATD_LOG_WARNING(fmtString,...) KARERE_LOG_WARNING(krLogChannel_chatd, fmtString, ##__VA_ARGS__)
 #define CHATD_LOG_ERROR(fmtString,...) KARERE_LOG_ERROR(krLogChannel_chatd, fmtString, ##__VA_ARGS__)
+#define CHATD_LOGD_DEBUG(fmtString,...) KARERE_LOGD_DEBUG(krLogChannel_chatd, fmtString, ##__VA_ARGS__)
 
 enum: uint32_t { kPromiseErrtype_chatd = 0x3e9ac47d }; //should resemble 'megachtd'
 
@@ -429,6 +430,10 @@ protected:
     /** Set of chats using the Connection object */
     std::set<karere::Id> mChatIds;
 
+    /** Chats with pending work to be flushed once the frame being processed is done,
+     * see Chat::onCommandsProcessed() */
+    std::set<karere::Id> mChatsToFlush;
+
     /** Client ID is received upon login to chatd, based on a seed */
     uint32_t mClientId = 0;
 
@@ -438,12 +443,9 @@ protected:
     /** When enabled, hearbeat() method is called periodically */
     bool mHeartbeatEnabled = false;
 
-    /** Target IP address being used for the reconnection in-flight */
+    /** Preferred IP address of the reconnection in-flight, or the connected one */
     std::string mTargetIp;
 
-    /** ip version to try first (both are tried) */
-    bool usingipv6 = false;
-
     /** RetryController that manages the reconnection's attempts */
     std::unique_ptr<karere::rh::IRetryController> mRetryCtrl;
 
@@ -464,6 +466,12 @@ protected:
     /** This promise is resolved when output data is written to the sockets */
     promise::Promise<void> mSendPromise;
 
+    /** While true, commands are accumulated in mSendBatch and written in as few
+     * frames as possible, of up to kMaxSendBatchSize bytes each */
+    bool mSendBatching = false;
+    Buffer mSendBatch;
+    static const size_t kMaxSendBatchSize = 64 * 1024;
+
     // ---- callbacks called from libwebsocketsIO ----
     virtual void wsConnectCb();
     virtual void wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len);
@@ -477,6 +485,10 @@ protected:
     void doConnect();
 // Destroys the buffer content
     bool sendBuf(Buffer&& buf);
+    bool sendFrame(Buffer&& buf);
+    void beginSendBatch();
+    bool flushSendBatch();
+    void endSendBatch();
     bool rejoinExistingChats();
     void resendPending();
     void join(karere::Id chatid);
@@ -749,16 +761,27 @@ protected:
     karere::Id mChatId;
     Idx mForwardStart;
     std::vector<std::unique_ptr<Message>> mForwardList;
-    std::vector<std::unique_ptr<Message>> mBackwardList;
+    // mutable, as evicted messages are loaded again by const lookups (see findOrNull())
+    mutable std::vector<std::unique_ptr<Message>> mBackwardList;
+    // payloads of the messages in the history buffer, so they don't need a heap block each
+    mutable BufferArena mPayloadArena;
     std::unique_ptr<FilteredHistory> mAttachmentNodes;
     OutputQueue mSending;
     OutputQueue::iterator mNextUnsent;
     bool mIsFirstJoin = true;
-    std::map<karere::Id, Idx> mIdToIndexMap;
+    mutable std::map<karere::Id, Idx> mIdToIndexMap;
     karere::Id mLastReceivedId;
     Idx mLastReceivedIdx = CHATD_IDX_INVALID;
     karere::Id mLastSeenId;
     Idx mLastSeenIdx = CHATD_IDX_INVALID;
+    /** @brief Cached result of \c unreadMsgCount(). It's updated incrementally when
+     * messages are received, edited or seen, and recomputed on demand after other
+     * changes (truncation, history reload...) */
+    mutable int mUnreadCount = 0;
+    mutable bool mUnreadCountValid = false;
+    /** @brief True if the count stored in db is \c mUnreadCount. Otherwise it's null in db
+     * until \c persistUnreadCount() is called */
+    mutable bool mUnreadCountStored = false;
     Idx mLastSeenInFlightIdx = CHATD_IDX_INVALID;
     Idx mLastIdxReceivedFromServer = CHATD_IDX_INVALID;
     karere::Id mLastIdReceivedFromServer;
@@ -779,13 +802,21 @@ protected:
     ServerHistFetchState mServerFetchState = kHistNotFetching;
 
     /** @brief Whether we have more not-loaded history in db */
-    bool mHasMoreHistoryInDb = false;
+    mutable bool mHasMoreHistoryInDb = false;
+    /** @brief Whether loading the initial window of history from db is deferred
+     * until the chat is used (see \c karere::Client::setLazyChatInit) */
+    bool mHistoryWindowPending = false;
     /** When true, OLDMSGs received from chatd are notified to the app */
     bool mServerOldHistCbEnabled = false;
     /** @brief Have reached the beggining of the history (not necessarily the end of it) */
     bool mHaveAllHistory = false;
     bool mIsDisabled = false;
     Idx mNextHistFetchIdx = CHATD_IDX_INVALID;
+    /** @brief Newest index when the app last requested history (see \c trimHistory) */
+    Idx mHistRequestHighnum = CHATD_IDX_INVALID;
+    /** @brief Oldest index evicted by \c trimHistory(). Messages from it to \c lownum() were
+     * already processed, so they can be loaded again from db without notifying them */
+    mutable Idx mOldestEvictedIdx = CHATD_IDX_INVALID;
     DbInterface* mDbInterface = nullptr;
     // last text message stuff
     LastTextMsgState mLastTextMsg;
@@ -822,6 +853,18 @@ protected:
      * of new messages may work synchronously and not be delayed.
      */
     Idx mDecryptOldHaltedAt = CHATD_IDX_INVALID;
+    /** True if decryption of new/old messages is halted at the first message of a history
+     * page received from server (OLDMSG or JOINRANGEHIST), instead of at a message waiting
+     * to be decrypted. It's resumed once the frame is processed, after the page is passed
+     * to the worker pool (see flushDecryptAhead()) */
+    bool mDecryptNewDeferred = false;
+    bool mDecryptOldDeferred = false;
+    /** Indexes of the messages queued for decryption while it's halted or deferred, pending
+     * to be passed to ICrypto::verifyBatch(). They are flushed once per received frame,
+     * so a page of history is verified and decrypted as a batch */
+    std::vector<Idx> mDecryptAheadQueue;
+    /** True while messages received from server are written to db in bulk-insert mode */
+    bool mDbBulkInsert = false;
     uint32_t mLastMsgTs;
     bool mIsGroup;
     std::set<karere::Id> mMsgsToUpdateWithRichLink;
@@ -841,7 +884,7 @@ protected:
     karere::Id mReactionSn = karere::Id::inval();
     // ====
     std::map<karere::Id, Message*> mPendingEdits;
-    std::map<BackRefId, Idx> mRefidToIdxMap;
+    mutable std::map<BackRefId, Idx> mRefidToIdxMap;
     Chat(Connection& conn, karere::Id chatid, Listener* listener,
     const karere::SetOfIds& users, uint32_t chatCreationTs, ICrypto* crypto, bool isGroup);
     void push_forward(Message* msg) { mForwardList.emplace_back(msg); }
@@ -858,6 +901,12 @@ protected:
     Idx msgIncoming(bool isNew, Message* msg, bool isLocal=false);
     bool msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx);
     void msgIncomingAfterDecrypt(bool isNew, bool isLocal, Message& msg, Idx idx);
+    void resumeDecrypt(bool isNew, Idx first);
+    void queueDecryptAhead(Idx idx);
+    void flushDecryptAhead();
+    void beginDbBulkInsert();
+    void endDbBulkInsert();
+    void onCommandsProcessed();
     bool msgNodeHistIncoming(Message* msg);
     void onUserJoin(karere::Id userid, Priv priv);
     void onUserLeave(karere::Id userid);
@@ -869,18 +918,25 @@ protected:
     void loadAndProcessUnsent();
     void initialFetchHistory(karere::Id serverNewest);
     void requestHistoryFromServer(int32_t count);
+    void reloadEvictedHistory(Idx idx) const;
     Idx getHistoryFromDb(unsigned count);
     HistSource getHistoryFromDbOrServer(unsigned count);
     void onLastReceived(karere::Id msgid);
     void onLastSeen(karere::Id msgid, bool resend = true);
     void handleLastReceivedSeen(karere::Id msgid);
+    int computeUnreadMsgCount() const;
+    void updateUnreadCount(int delta);
+    void updateUnreadCountOnSeen(Idx oldIdx, Idx newIdx);
+    void invalidateUnreadCount();
+    void setUnreadCountChanged() const;
     bool msgSend(const Message& message);
     void setOnlineState(ChatState state);
     SendingItem* postMsgToSending(uint8_t opcode, Message* msg, karere::SetOfIds recipients);
     bool sendKeyAndMessage(std::pair<MsgCommand*, KeyCommand*> cmd);
     void flushOutputQueue(bool fromStart=false);
     karere::Id makeRandomId();
-    void login();
+    /** Joins the chat. If \c dbInfo is null, the history info is read from db */
+    void login(const ChatDbInfo* dbInfo = nullptr);
     void join();
     void handlejoin();
     void handleleave();
@@ -1019,9 +1075,22 @@ public:
 
     /** @brief
      * Get the message with the specified index, or \c NULL if that
-     * index is out of range
+     * index is out of range. Messages evicted from RAM by \c trimHistory()
+     * are loaded again from db
      */
     inline Message* findOrNull(Idx num) const
+    {
+        Message* msg = findInRam(num);
+        if (!msg && mOldestEvictedIdx != CHATD_IDX_INVALID)
+        {
+            reloadEvictedHistory(num);
+            msg = findInRam(num);
+        }
+        return msg;
+    }
+
+    /** @brief Like \c findOrNull(), but without loading evicted messages */
+    inline Message* findInRam(Idx num) const
     {
         if (num < mForwardStart) //look in mBackwardList
         {
@@ -1040,8 +1109,8 @@ public:
     }
 
     /**
-     * @brief Returns the message at the specified index in the RAM history buffer.
-     * Throws if index is out of range
+     * @brief Returns the message at the specified index in the RAM history buffer,
+     * loading it again if it was evicted. Throws if index is out of range
      */
     Message& at(Idx num) const
     {
@@ -1061,6 +1130,29 @@ public:
      */
     Message& operator[](Idx num) const { return at(num); }
 
+    /**
+     * @brief Evicts the oldest messages from the RAM history buffer, keeping the newest
+     * \c keep ones and the older range the app is viewing, if it requested it before the
+     * last \c keep messages were received. Evicted messages remain in db and are loaded
+     * again by \c getHistory(), \c findOrNull(), \c at() and \c msgIndexFromIdOrDb().
+     * Nothing is evicted while history is being fetched from server or decrypted.
+     * @return The number of messages evicted
+     */
+    Idx trimHistory(Idx keep);
+
+    /**
+     * @brief Returns the index of the message with the specified msgid, like \c msgIndexFromId(),
+     * but loads it from db if it was evicted by \c trimHistory().
+     */
+    Idx msgIndexFromIdOrDb(karere::Id msgid);
+
+    /**
+     * @brief Loads the initial window of history from db, if it was deferred when the
+     * chat was created. It's called when the chat is opened by the app or a message is
+     * sent. Does nothing if any history has already been loaded from db.
+     */
+    void loadHistoryWindow();
+
     /** @brief Returns whether the specified RAM history buffer index is valid or out
      * of range
      */
@@ -1235,6 +1327,10 @@ public:
       */
     int unreadMsgCount() const;
 
+    /** @brief Stores the unread count in db if it changed. It's done at the end of history
+     * bursts and periodically, rather than for every message */
+    void persistUnreadCount();
+
     /** @brief Returns the text of the most-recent message in the chat that can
      * be displayed as text in the chat list. If it is not found in RAM,
      * the database will be queried. If not found there as well, server is queried,
@@ -1443,6 +1539,9 @@ public:
 
     enum: uint8_t { kRichLinkNotDefined = 0,  kRichLinkEnabled = 1, kRichLinkDisabled = 2};
 
+    /** Messages kept in RAM per chat by default, besides the range viewed by the app */
+    static const Idx kDefaultHistoryResidentWindow = 1024;
+
     MyMegaApi *mApi;
     karere::Client *mKarereClient;
     IRtcHandler *mRtcHandler = nullptr;
@@ -1479,6 +1578,15 @@ public:
     /** Clean the timers set */
     void cancelSeenTimers();
 
+    /**
+     * @brief Trims the RAM history buffers of the chats if the total limit is exceeded
+     * (see \c karere::Client::setHistoryResidentLimits)
+     */
+    void trimHistory();
+
+    /** @brief Stores in db the unread count of the chats that changed (see \c Chat::persistUnreadCount) */
+    void persistUnreadCounts();
+
     // True if clients send confirmation to chatd when they receive a new message
     bool isMessageReceivedConfirmationActive() const;
 
@@ -1592,8 +1700,21 @@ public:
 
     virtual void getHistoryInfo(ChatDbInfo& info) = 0;
 
+    /**
+     * @brief Gets the history info of every chat in the specified shard at once, so
+     * chats can be joined without querying the db for each of them.
+     * @param [out] infos The info of each chat, by chatid. Chats not found in the
+     * db are not included, so \c getHistoryInfo() must be used for them. Rows buffered by
+     * other chats of the shard in bulk mode must be flushed before (see \c flushBulkInsert())
+     */
+    virtual void getHistoryInfoOfShard(int shard, std::map<karere::Id, ChatDbInfo>& infos) = 0;
+
     virtual void setLastSeen(karere::Id msgid) = 0;
     virtual void setLastReceived(karere::Id msgid) = 0;
+    /** Returns false if there is no unread count stored for the chat */
+    virtual bool getUnreadCount(int& count) = 0;
+    virtual void setUnreadCount(int count) = 0;
+    virtual void invalidateUnreadCount() = 0;
 
     virtual void setChatVar (const char *name, bool value) = 0;
     virtual bool chatVar (const char *name) = 0;
@@ -1611,6 +1732,17 @@ public:
 
     virtual Idx getIdxOfMsgidFromNodeHistory(karere::Id msgid) = 0;
 
+    //  <<<--- Bulk import of history --->>>
+
+    /** Starts a burst of history received from server: messages added to history and
+     * changes of reactions may be buffered and written at once, in a single transaction */
+    virtual void beginBulkInsert() = 0;
+    /** Writes any buffered change and commits the transaction */
+    virtual void endBulkInsert() = 0;
+    /** Writes any buffered change, without leaving the bulk mode. Needed before queries
+     * that read the history of other chats */
+    virtual void flushBulkInsert() = 0;
+
     //  <<<--- Reaction methods --->>>
     virtual std::string getReactionSn() = 0;
     virtual void setReactionSn(const std::string &rsn) = 0;
@@ -1618,6 +1750,9 @@ public:
     virtual void addReaction(karere::Id msgId, karere::Id userId, const char *reaction) = 0;
     virtual void delReaction(karere::Id msgId, karere::Id userId, const char *reaction) = 0;
     virtual void getMessageReactions(karere::Id msgId, ::mega::multimap<std::string, karere::Id>& reactions) = 0;
+
+    /// get the reactions of every message in history with idx in range [oldestIdx, newestIdx], grouped by msgid
+    virtual void getMessageReactionsInRange(Idx oldestIdx, Idx newestIdx, std::map<karere::Id, ::mega::multimap<std::string, karere::Id>>& reactions) = 0;
 };
 
 }
@@ -12,11 +12,74 @@ protected:
     chatd::Chat& mChat;
     std::string mSendingTblName;
     std::string mHistTblName;
+
+    /** A history row buffered while in bulk-insert mode */
+    struct BulkRow
+    {
+        chatd::Idx idx;
+        karere::Id msgid;
+        chatd::KeyId keyid;
+        unsigned char type;
+        karere::Id userid;
+        uint32_t ts;
+        uint16_t updated;
+        Buffer data;
+        uint64_t backRefId;
+        uint8_t isEncrypted;
+    };
+    /** A change of reactions deferred while in bulk-insert mode */
+    struct BulkReaction
+    {
+        enum Op: uint8_t { kAdd, kDel, kClean };
+        Op op;
+        karere::Id msgid;
+        karere::Id userid;
+        std::string reaction;
+    };
+    // rows per multi-row insert: 11 params each, below the default SQLITE_MAX_VARIABLE_NUMBER (999)
+    static const size_t kBulkInsertRows = 64;
+    bool mBulkInsert = false;
+    std::vector<BulkRow> mBulkRows;
+    std::vector<BulkReaction> mBulkReactions;
+
+    void insertBulkRows(size_t first, size_t count)
+    {
+        std::string query = "insert into history (idx, chatid, msgid, keyid, type, userid, ts, updated, data, backrefid, is_encrypted) values";
+        for (size_t i = 0; i < count; i++)
+        {
+            query.append(i ? ",(?,?,?,?,?,?,?,?,?,?,?)" : "(?,?,?,?,?,?,?,?,?,?,?)");
+        }
+        SqliteStmt stmt(mDb, query);
+        for (size_t i = first; i < first + count; i++)
+        {
+            const BulkRow& row = mBulkRows[i];
+            stmt.bindV(row.idx, mChat.chatId(), row.msgid, row.keyid, row.type, row.userid,
+                       row.ts, row.updated, row.data, row.backRefId, row.isEncrypted);
+        }
+        stmt.step();
+    }
+
+    void writeCleanReactions(karere::Id msgId)
+    {
+        mDb.query("delete from chat_reactions where chatid = ? and msgId = ?", mChat.chatId(), msgId);
+    }
+    void writeAddReaction(karere::Id msgId, karere::Id userId, const char *reaction)
+    {
+        mDb.query("insert into chat_reactions(chatid, msgid, userid, reaction)"
+            "values(?,?,?,?)", mChat.chatId(), msgId, userId, reaction);
+    }
+    void writeDelReaction(karere::Id msgId, karere::Id userId, const char *reaction)
+    {
+        mDb.query("delete from chat_reactions where chatid = ? and msgid = ? and userid = ? and reaction = ?",
+            mChat.chatId(), msgId, userId, reaction);
+    }
+
 public:
     ChatdSqliteDb(chatd::Chat& chat, SqliteDb& db, const std::string& sendingTblName="sending", const std::string& histTblName="history")
         :mDb(db), mChat(chat), mSendingTblName(sendingTblName), mHistTblName(histTblName){}
     virtual void getHistoryInfo(chatd::ChatDbInfo& info)
     {
+        flushBulkInsert();
         SqliteStmt stmt(mDb, "select min(idx), max(idx) from history where chatid=?1");
         stmt.bind(mChat.chatId()).step(); //will always return a row, even if table empty
         auto minIdx = stmt.intCol(0); //WARNING: the chatd implementation uses uint32_t values for idx.
@@ -45,6 +108,36 @@ public:
         info.lastSeenId = stmt3.uint64Col(0);
         info.lastRecvId = stmt3.uint64Col(1);
     }
+    virtual void getHistoryInfoOfShard(int shard, std::map<karere::Id, chatd::ChatDbInfo>& infos)
+    {
+        flushBulkInsert();
+        // correlated subqueries, so only the history range of each chat is read
+        SqliteStmt stmt(mDb, "select chats.chatid, chats.last_seen, chats.last_recv, "
+            "(select max(idx) from history where chatid = chats.chatid), "
+            "(select msgid from history where chatid = chats.chatid order by idx asc limit 1), "
+            "(select msgid from history where chatid = chats.chatid order by idx desc limit 1) "
+            "from chats where chats.shard = ?");
+        stmt << shard;
+        while (stmt.step())
+        {
+            chatd::ChatDbInfo& info = infos[stmt.uint64Col(0)];
+            if (sqlite3_column_type(stmt, 3) == SQLITE_NULL) //no db history
+            {
+                memset(&info, 0, sizeof(info));
+                continue;
+            }
+            info.newestDbIdx = stmt.intCol(3);
+            info.oldestDbId = stmt.uint64Col(4);
+            info.newestDbId = stmt.uint64Col(5);
+            info.lastSeenId = stmt.uint64Col(1);
+            info.lastRecvId = stmt.uint64Col(2);
+            if (!info.newestDbId)
+            {
+                CHATD_LOG_WARNING("Db: Newest msgid in db is null, telling chatd we don't have local history");
+                info.oldestDbId = 0;
+            }
+        }
+    }
     void assertAffectedRowCount(int count, const char* opname=nullptr)
     {
         auto actual = sqlite3_changes(mDb);
@@ -59,9 +152,11 @@ public:
         throw std::runtime_error(msg);
     }
 
-    void addMessage(const chatd::Message& msg, chatd::Idx idx, const std::string& table)
-    {
 #ifndef NDEBUG
+    /** Checks that \c idx is adjacent to one end of the history of the chat, including the
+     * rows buffered in bulk-insert mode */
+    void checkIdxContinuity(const chatd::Message& msg, chatd::Idx idx, const std::string& table)
+    {
         std::string checkQuery = "select min(idx), max(idx), count(*) from " + table + " where chatid = ?";
         SqliteStmt stmt(mDb, checkQuery.c_str());
         stmt << mChat.chatId();
@@ -69,6 +164,15 @@ public:
         int low = stmt.intCol(0);
         int high = stmt.intCol(1);
         int count = stmt.intCol(2);
+        if (table == "history")
+        {
+            for (const BulkRow& row: mBulkRows)
+            {
+                low = count ? std::min(low, row.idx) : row.idx;
+                high = count ? std::max(high, row.idx) : row.idx;
+                count++;
+            }
+        }
         if ((count > 0) && (idx != low-1) && (idx != high+1))
         {
             CHATD_LOG_ERROR("chatid %s: addMsgToHistory: %s discontinuity detected: "
@@ -78,6 +182,13 @@ public:
                 idx, low, high, count);
             assert(false);
         }
+    }
+#endif
+
+    void addMessage(const chatd::Message& msg, chatd::Idx idx, const std::string& table)
+    {
+#ifndef NDEBUG
+        checkIdxContinuity(msg, idx, table);
 #endif
         std::string query = "insert into " + table + " (idx, chatid, msgid, keyid, type, userid, ts, updated, data, backrefid, is_encrypted) " +
                                                      "values(?,?,?,?,?,?,?,?,?,?,?)";
@@ -149,10 +260,73 @@ public:
     }
     virtual void addMsgToHistory(const chatd::Message& msg, chatd::Idx idx)
     {
-        addMessage(msg, idx, "history");
+        if (!mBulkInsert)
+        {
+            addMessage(msg, idx, "history");
+            return;
+        }
+
+#ifndef NDEBUG
+        checkIdxContinuity(msg, idx, "history");
+#endif
+        mBulkRows.push_back({idx, msg.id(), msg.keyid, msg.type, msg.userid, msg.ts, msg.updated,
+                             Buffer(msg.buf(), msg.dataSize()), msg.backRefId, msg.isEncrypted()});
+    }
+    virtual void beginBulkInsert()
+    {
+        if (mBulkInsert)
+            return;
+        mBulkInsert = true;
+        mDb.beginBulk();
+    }
+    virtual void endBulkInsert()
+    {
+        if (!mBulkInsert)
+            return;
+        mBulkInsert = false;
+        try
+        {
+            flushBulkInsert();
+        }
+        catch (std::exception&)
+        {
+            // don't leave the db in bulk mode
+            mBulkRows.clear();
+            mBulkReactions.clear();
+            mDb.endBulk();
+            throw;
+        }
+        mDb.endBulk();
+    }
+    virtual void flushBulkInsert()
+    {
+        size_t i = 0;
+        size_t count = mBulkRows.size();
+        for (; i + kBulkInsertRows <= count; i += kBulkInsertRows)
+        {
+            insertBulkRows(i, kBulkInsertRows);
+        }
+        // the remainder uses the single-row statement, so only one multi-row statement is cached
+        for (; i < count; i++)
+        {
+            insertBulkRows(i, 1);
+        }
+        mBulkRows.clear();
+
+        for (const BulkReaction& r: mBulkReactions)
+        {
+            switch (r.op)
+            {
+                case BulkReaction::kAdd:    writeAddReaction(r.msgid, r.userid, r.reaction.c_str()); break;
+                case BulkReaction::kDel:    writeDelReaction(r.msgid, r.userid, r.reaction.c_str()); break;
+                case BulkReaction::kClean:  writeCleanReactions(r.msgid); break;
+            }
+        }
+        mBulkReactions.clear();
     }
     virtual void updateMsgInHistory(karere::Id msgid, const chatd::Message& msg)
     {
+        flushBulkInsert();
         if (msg.type == chatd::Message::kMsgTruncate)
         {
             mDb.query("update history set type = ?, data = ?, ts = ?, userid = ?, keyid = ? where chatid = ? and msgid = ?",
@@ -168,6 +342,7 @@ public:
 
     virtual void getMessageDelta(karere::Id msgid, uint16_t *updated)
     {
+        flushBulkInsert();
         SqliteStmt stmt3(mDb, "select updated from history where chatid = ? and msgid = ?");
         stmt3 << mChat.chatId() << msgid;
         stmt3.stepMustHaveData();
@@ -250,6 +425,7 @@ public:
 
     virtual chatd::Idx getIdxOfMsgid(karere::Id msgid, const std::string &table)
     {
+        flushBulkInsert();
         std::string query = "select idx from " + table + " where chatid = ? and msgid = ?";
         SqliteStmt stmt(mDb, query.c_str());
         stmt << mChat.chatId() << msgid;
@@ -262,41 +438,44 @@ public:
     }
     virtual chatd::Idx getUnreadMsgCountAfterIdx(chatd::Idx idx)
     {
+        flushBulkInsert();
+
         // get the unread messages count --> conditions should match the ones in Message::isValidUnread()
+        // The types and deleted-message conditions are literals so the query can use the partial
+        // index `history_unread` (see dbSchema.sql): include only known type of messages
+        static_assert(chatd::Message::kMsgNormal == 1 && chatd::Message::kMsgAttachment == 101
+                      && chatd::Message::kMsgContact == 103 && chatd::Message::kMsgContainsMeta == 104
+                      && chatd::Message::kMsgVoiceClip == 105, "Update the index history_unread");
         std::string sql = "select count(*) from history where (chatid = ?1)"
                 "and (userid != ?2)"
-                "and not (updated != 0 and length(data) = 0)"
+                "and NOT (updated != 0 AND length(data) = 0)"
                 "and (is_encrypted = ?3 or is_encrypted = ?4 or is_encrypted = ?5)"
-                "and (type = ?6 or type = ?7 or type = ?8 or type = ?9 or type = ?10)";
+                "and type IN (1, 101, 103, 104, 105)";
         if (idx != CHATD_IDX_INVALID)
-            sql+=" and (idx > ?11)";
+            sql+=" and (idx > ?6)";
 
         SqliteStmt stmt(mDb, sql);
         stmt << mChat.chatId() << mChat.client().myHandle()   // skip own messages
              << chatd::Message::kNotEncrypted               // include decrypted messages
              << chatd::Message::kEncryptedMalformed         // include encrypted messages due to malformed payload
-             << chatd::Message::kEncryptedSignature         // include encrypted messages due to invalid signature
-             << chatd::Message::kMsgNormal                  // include only known type of messages
-             << chatd::Message::kMsgAttachment
-             << chatd::Message::kMsgContact
-             << chatd::Message::kMsgContainsMeta
-             << chatd::Message::kMsgVoiceClip;
+             << chatd::Message::kEncryptedSignature;        // include encrypted messages due to invalid signature
         if (idx != CHATD_IDX_INVALID)
             stmt << idx;
         stmt.stepMustHaveData("get peer msg count");
         int32_t unReadCount = stmt.intCol(0);
 
+        // include only End call messages, using the partial index `history_call_end`
+        static_assert(chatd::Message::kMsgCallEnd == 6, "Update the index history_call_end");
         sql = "select data from history where (chatid = ?1)"
                 "and (userid != ?2 )"
                 "and (ts > ?3)"
-                "and (type = ?4)";
+                "and type = 6";
         if (idx != CHATD_IDX_INVALID)
-            sql+=" and (idx > ?5)";
+            sql+=" and (idx > ?4)";
 
         SqliteStmt stmtEndCAll(mDb, sql);
         stmtEndCAll << mChat.chatId() << mChat.client().myHandle() // skip own messages
-                    << chatd::kTsMissingCallUnread // skip messages older than kTsMissingCallUnread
-                    << chatd::Message::kMsgCallEnd;                // include only End call messages
+                    << chatd::kTsMissingCallUnread; // skip messages older than kTsMissingCallUnread
         if (idx != CHATD_IDX_INVALID)
             stmtEndCAll << idx;
 
@@ -360,6 +539,7 @@ public:
     }
     virtual void truncateHistory(const chatd::Message& msg)
     {
+        flushBulkInsert();
         auto idx = getIdxOfMsgidFromHistory(msg.id());
         if (idx == CHATD_IDX_INVALID)
             throw std::runtime_error("dbInterface::truncateHistory: msgid "+msg.id().toString()+" does not exist in db");
@@ -378,6 +558,7 @@ public:
     }
     virtual chatd::Idx getOldestIdx()
     {
+        flushBulkInsert();
         SqliteStmt stmt(mDb, "select min(idx) from history where chatid = ?");
         stmt << mChat.chatId();
         stmt.stepMustHaveData(__FUNCTION__);
@@ -393,6 +574,25 @@ public:
         mDb.query("update chats set last_recv=? where chatid=?", msgid, mChat.chatId());
         assertAffectedRowCount(1);
     }
+    virtual bool getUnreadCount(int& count)
+    {
+        SqliteStmt stmt(mDb, "select unread_count from chats where chatid=?");
+        stmt << mChat.chatId();
+        if (!stmt.step() || sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+            return false;
+
+        count = stmt.intCol(0);
+        return true;
+    }
+    virtual void setUnreadCount(int count)
+    {
+        mDb.query("update chats set unread_count=? where chatid=?", count, mChat.chatId());
+        assertAffectedRowCount(1);
+    }
+    virtual void invalidateUnreadCount()
+    {
+        mDb.query("update chats set unread_count=null where chatid=?", mChat.chatId());
+    }
 
     virtual void setHaveAllHistory(bool haveAllHistory)
     {
@@ -411,15 +611,17 @@ public:
 
     virtual void getLastTextMessage(chatd::Idx from, chatd::LastTextMsgState& msg, uint32_t& lastTs)
     {
+        flushBulkInsert();
+        // the conditions are literals so the query can use the partial index `history_last_text`:
+        // include truncates, exclude revokes and (still) encrypted messages (theorically, they
+        // should not be stored in DB)
+        static_assert(chatd::Message::kMsgTruncate == 3 && chatd::Message::kMsgRevokeAttachment == 102
+                      && chatd::Message::kMsgInvalid == 0, "Update the index history_last_text");
         SqliteStmt stmt(mDb,
             "select type, idx, data, msgid, userid, ts from history where chatid=?1 and "
-            "(length(data) > 0 OR type = ?2) and type != ?3  and type != ?4 and (idx <= ?5)"
+            "(length(data) > 0 OR type = 3) AND type != 102 AND type != 0 and (idx <= ?2)"
             "order by idx desc limit 1");
-        stmt << mChat.chatId()
-             << chatd::Message::kMsgTruncate
-             << chatd::Message::kMsgRevokeAttachment
-             << chatd::Message::kMsgInvalid     // exclude (still) encrypted messages (theorically, they should not be stored in DB)
-             << from;
+        stmt << mChat.chatId() << from;
         if (!stmt.step())
         {
 
@@ -471,6 +673,8 @@ public:
 
     virtual void clearHistory()
     {
+        mBulkRows.clear();
+        mBulkReactions.clear();
         mDb.query("delete from history where chatid = ?", mChat.chatId());
         setHaveAllHistory(false);
     }
@@ -530,6 +734,7 @@ public:
 
     void loadMessages(int count, chatd::Idx idx, std::vector<chatd::Message*>& messages, const std::string &table)
     {
+        flushBulkInsert();
         std::string query = "select msgid, userid, ts, type, data, idx, keyid, backrefid, updated, is_encrypted from " + table +
                             " where chatid = ?1 and idx <= ?2 order by idx desc limit ?3";
 
@@ -579,23 +784,37 @@ public:
 
     void cleanReactions(karere::Id msgId) override
     {
-        mDb.query("delete from chat_reactions where chatid = ? and msgId = ?", mChat.chatId(), msgId);
+        if (mBulkInsert)
+        {
+            mBulkReactions.push_back({BulkReaction::kClean, msgId, karere::Id::null(), std::string()});
+            return;
+        }
+        writeCleanReactions(msgId);
     }
 
     void addReaction(karere::Id msgId, karere::Id userId, const char *reaction) override
     {
-        mDb.query("insert into chat_reactions(chatid, msgid, userid, reaction)"
-            "values(?,?,?,?)", mChat.chatId(), msgId, userId, reaction);
+        if (mBulkInsert)
+        {
+            mBulkReactions.push_back({BulkReaction::kAdd, msgId, userId, reaction});
+            return;
+        }
+        writeAddReaction(msgId, userId, reaction);
     }
 
     void delReaction(karere::Id msgId, karere::Id userId, const char *reaction) override
     {
-        mDb.query("delete from chat_reactions where chatid = ? and msgid = ? and userid = ? and reaction = ?",
-            mChat.chatId(), msgId, userId, reaction);
+        if (mBulkInsert)
+        {
+            mBulkReactions.push_back({BulkReaction::kDel, msgId, userId, reaction});
+            return;
+        }
+        writeDelReaction(msgId, userId, reaction);
     }
 
     void getMessageReactions(karere::Id msgId, ::mega::multimap<std::string, karere::Id>& reactions) override
     {
+        flushBulkInsert();
         SqliteStmt stmt(mDb, "select reaction, userid from chat_reactions where chatid = ? and msgid = ?");
         stmt << mChat.chatId();
         stmt << msgId;
@@ -604,6 +823,20 @@ public:
             reactions.insert(std::pair<std::string, karere::Id>(stmt.stringCol(0), stmt.uint64Col(1)));
         }
     }
+
+    void getMessageReactionsInRange(chatd::Idx oldestIdx, chatd::Idx newestIdx, std::map<karere::Id, ::mega::multimap<std::string, karere::Id>>& reactions) override
+    {
+        flushBulkInsert();
+        SqliteStmt stmt(mDb, "select chat_reactions.msgid, chat_reactions.reaction, chat_reactions.userid "
+            "from chat_reactions join history on history.chatid = chat_reactions.chatid "
+            "and history.msgid = chat_reactions.msgid "
+            "where chat_reactions.chatid = ?1 and history.idx >= ?2 and history.idx <= ?3");
+        stmt << mChat.chatId() << oldestIdx << newestIdx;
+        while (stmt.step())
+        {
+            reactions[stmt.uint64Col(0)].insert(std::pair<std::string, karere::Id>(stmt.stringCol(1), stmt.uint64Col(2)));
+        }
+    }
 };
 
 #endif
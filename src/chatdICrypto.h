@@ -20,6 +20,7 @@ enum
 class Chat;
 class ICrypto
 {
+protected:
     void *appCtx;
     
 public:
@@ -77,6 +78,15 @@ public:
      */
     virtual promise::Promise<Message*> msgDecrypt(Message* src) = 0;
 
+    /**
+     * @brief Called by the client with the received messages that are queued for decryption:
+     * a page of history received from server (OLDMSG or JOINRANGEHIST), or the messages received
+     * while the decryption of a previous message has not finished yet. The crypto module may verify
+     * and decrypt them in background, so the result is ready when \c msgDecrypt() is called for
+     * each message, in order. The messages must not be modified by this method.
+     */
+    virtual void verifyBatch(const std::vector<Message*>& /*msgs*/) {}
+
     /**
      * @brief The chatroom connection (to the chatd server shard) state state has changed.
      */
@@ -653,30 +653,34 @@ public:
         }
     };
 
+    // members are ordered by size, so there's no padding between them (a Message is 120 bytes instead of 144)
 private:
     //avoid setting the id and flag pairs one by one by making them accessible only by setId(Id,bool)
     karere::Id mId;
-    bool mIdIsXid = false;
 
     /* Reactions must be ordered in the same order as they were added,
     so we need a sequence container */
     std::vector<Reaction> mReactions;
 
-protected:
-    uint8_t mIsEncrypted = kNotEncrypted;
-
 public:
     karere::Id userid;
     uint32_t ts;
-    uint16_t updated;
     KeyId keyid;
-    unsigned char type;
     BackRefId backRefId = 0;
     std::vector<BackRefId> backRefs;
     mutable void* userp;
+    uint16_t updated;
+    unsigned char type;
     mutable uint8_t userFlags = 0;
     bool richLinkRemoved = 0;
 
+private:
+    bool mIdIsXid = false;
+
+protected:
+    uint8_t mIsEncrypted = kNotEncrypted;
+
+public:
     karere::Id id() const { return mId; }
     void setId(karere::Id aId, bool isXid) { mId = aId; mIdIsXid = isXid; }
     bool isSending() const { return mIdIsXid; }
@@ -692,20 +696,20 @@ public:
     explicit Message(karere::Id aMsgid, karere::Id aUserid, uint32_t aTs, uint16_t aUpdated,
           Buffer&& buf, bool aIsSending=false, KeyId aKeyid=CHATD_KEYID_INVALID,
           unsigned char aType=kMsgNormal, void* aUserp=nullptr)
-      :Buffer(std::forward<Buffer>(buf)), mId(aMsgid), mIdIsXid(aIsSending), userid(aUserid),
-          ts(aTs), updated(aUpdated), keyid(aKeyid), type(aType), userp(aUserp){}
+      :Buffer(std::forward<Buffer>(buf)), mId(aMsgid), userid(aUserid), ts(aTs), keyid(aKeyid),
+          userp(aUserp), updated(aUpdated), type(aType), mIdIsXid(aIsSending){}
 
     explicit Message(karere::Id aMsgid, karere::Id aUserid, uint32_t aTs, uint16_t aUpdated,
             const char* msg, size_t msglen, bool aIsSending=false,
             KeyId aKeyid=CHATD_KEYID_INVALID, unsigned char aType=kMsgInvalid, void* aUserp=nullptr,
             BackRefId aBackRefId = 0, std::vector<BackRefId> aBackRefs = std::vector<BackRefId>())
-        :Buffer(msg, msglen), mId(aMsgid), mIdIsXid(aIsSending), userid(aUserid), ts(aTs),
-            updated(aUpdated), keyid(aKeyid), type(aType), userp(aUserp), backRefId(aBackRefId), backRefs(aBackRefs){}
+        :Buffer(msg, msglen), mId(aMsgid), userid(aUserid), ts(aTs), keyid(aKeyid), backRefId(aBackRefId),
+            backRefs(aBackRefs), userp(aUserp), updated(aUpdated), type(aType), mIdIsXid(aIsSending){}
 
     Message(const Message& msg)
-        : Buffer(msg.buf(), msg.dataSize()), mId(msg.id()), mIdIsXid(msg.mIdIsXid), mIsEncrypted(msg.mIsEncrypted),
-          userid(msg.userid), ts(msg.ts), updated(msg.updated), keyid(msg.keyid), type(msg.type), backRefId(msg.backRefId),
-          backRefs(msg.backRefs), userp(msg.userp), userFlags(msg.userFlags), richLinkRemoved(msg.richLinkRemoved)
+        : Buffer(msg.buf(), msg.dataSize()), mId(msg.id()), userid(msg.userid), ts(msg.ts), keyid(msg.keyid),
+          backRefId(msg.backRefId), backRefs(msg.backRefs), userp(msg.userp), updated(msg.updated), type(msg.type),
+          userFlags(msg.userFlags), richLinkRemoved(msg.richLinkRemoved), mIdIsXid(msg.mIdIsXid), mIsEncrypted(msg.mIsEncrypted)
     {}
 
     /** @brief Returns the ManagementInfo structure contained within the message
@@ -2,6 +2,9 @@
 #define _KARERE_DB_H
 
 #include <sqlite3.h>
+#include <list>
+#include <string>
+#include <unordered_map>
 
 struct SqliteString
 {
@@ -16,6 +19,84 @@ struct SqliteString
 };
 class SqliteStmt;
 
+/** LRU cache of prepared statements, keyed by their SQL text.
+ * A statement is removed from the cache while it is in use by a SqliteStmt,
+ * so two SqliteStmt instances with the same SQL never share a handle. When
+ * returned, the statement is reset and its bindings cleared.
+ */
+class SqliteStmtCache
+{
+protected:
+    typedef std::list<std::pair<std::string, sqlite3_stmt*>> LruList;
+    LruList mLru;   // most recently used first
+    std::unordered_map<std::string, LruList::iterator> mIndex;
+    size_t mCapacity;
+    uint64_t mHits = 0;
+    uint64_t mMisses = 0;
+public:
+    SqliteStmtCache(size_t capacity=64): mCapacity(capacity) {}
+    ~SqliteStmtCache() { clear(); }
+    /** Returns a cached statement for \c sql (removing it from the cache), or
+     * nullptr if there is none. Updates the hit/miss counters */
+    sqlite3_stmt* take(const std::string& sql)
+    {
+        auto it = mIndex.find(sql);
+        if (it == mIndex.end())
+        {
+            mMisses++;
+            return nullptr;
+        }
+        mHits++;
+        sqlite3_stmt* stmt = it->second->second;
+        mLru.erase(it->second);
+        mIndex.erase(it);
+        return stmt;
+    }
+    /** Puts back a statement. It is finalized if caching is disabled or
+     * there is already another statement with the same SQL in the cache */
+    void put(const std::string& sql, sqlite3_stmt* stmt)
+    {
+        if (!mCapacity || mIndex.find(sql) != mIndex.end())
+        {
+            sqlite3_finalize(stmt);
+            return;
+        }
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        mLru.emplace_front(sql, stmt);
+        mIndex[sql] = mLru.begin();
+        if (mLru.size() > mCapacity)
+        {
+            auto& oldest = mLru.back();
+            sqlite3_finalize(oldest.second);
+            mIndex.erase(oldest.first);
+            mLru.pop_back();
+        }
+    }
+    /** Finalizes all cached statements. Must be called before closing the db */
+    void clear()
+    {
+        for (auto& item: mLru)
+            sqlite3_finalize(item.second);
+        mLru.clear();
+        mIndex.clear();
+    }
+    void setCapacity(size_t capacity)
+    {
+        mCapacity = capacity;
+        while (mLru.size() > mCapacity)
+        {
+            auto& oldest = mLru.back();
+            sqlite3_finalize(oldest.second);
+            mIndex.erase(oldest.first);
+            mLru.pop_back();
+        }
+    }
+    size_t size() const { return mLru.size(); }
+    uint64_t hits() const { return mHits; }
+    uint64_t misses() const { return mMisses; }
+};
+
 class SqliteDb
 {
 protected:
@@ -25,6 +106,8 @@ protected:
     bool mHasOpenTransaction = false;
     uint16_t mCommitInterval = 20;
     time_t mLastCommitTs = 0;
+    unsigned mBulkDepth = 0;
+    SqliteStmtCache mStmtCache;
     inline int step(SqliteStmt& stmt);
     void beginTransaction()
     {
@@ -84,8 +167,10 @@ public:
     {
         if (!mDb)
             return;
-        if (!mCommitEach)
+        if (!mCommitEach || mBulkDepth)
             commitTransaction();
+        mBulkDepth = 0;
+        mStmtCache.clear();
         sqlite3_close(mDb);
         mDb = nullptr;
         mLastCommitTs = 0;
@@ -106,9 +191,37 @@ public:
             beginTransaction();
         }
     }
+    /** Starts a bulk write: statements are grouped in a single transaction, which is
+     * not committed by timedCommit(), until the outermost endBulk() is called */
+    void beginBulk()
+    {
+        if (mBulkDepth++ == 0 && mCommitEach && !mHasOpenTransaction)
+        {
+            beginTransaction();
+        }
+    }
+    void endBulk()
+    {
+        assert(mBulkDepth);
+        if (!mBulkDepth || --mBulkDepth)
+            return;
+
+        if (mCommitEach)
+        {
+            commitTransaction();
+        }
+        else
+        {
+            commit();
+        }
+    }
     bool commitEach() { return mCommitEach; }   // false for transactional
     void setCommitInterval(uint16_t sec) { mCommitInterval = sec; }
     bool hasOpenTransaction() const { return !mHasOpenTransaction; }
+    /** Max number of prepared statements kept for reuse. Zero disables the cache */
+    void setStmtCacheCapacity(size_t capacity) { mStmtCache.setCapacity(capacity); }
+    uint64_t stmtCacheHits() const { return mStmtCache.hits(); }
+    uint64_t stmtCacheMisses() const { return mStmtCache.misses(); }
     operator sqlite3*() { return mDb; }
     operator const sqlite3*() const { return mDb; }
     template <class... Args>
@@ -140,7 +253,7 @@ public:
     }
     bool timedCommit()
     {
-        if (mCommitEach)
+        if (mCommitEach || mBulkDepth)
             return false;
 
         auto now = time(NULL);
@@ -157,6 +270,7 @@ class SqliteStmt
 protected:
     sqlite3_stmt* mStmt;
     SqliteDb& mDb;
+    std::string mSql;
     int mLastBindCol = 0;
     void retCheck(int code, const char* opname)
     {
@@ -182,8 +296,12 @@ protected:
         return msg;
     }
 public:
-    SqliteStmt(SqliteDb& db, const char* sql):mDb(db)
+    SqliteStmt(SqliteDb& db, const char* sql):mDb(db), mSql(sql)
     {
+        mStmt = db.mStmtCache.take(mSql);
+        if (mStmt)
+            return;
+
         if (sqlite3_prepare_v2(db, sql, -1, &mStmt, nullptr) != SQLITE_OK)
         {
             const char* errMsg = sqlite3_errmsg(mDb);
@@ -196,10 +314,12 @@ public:
     }
     SqliteStmt(SqliteDb& db, const std::string& sql)
         :SqliteStmt(db, sql.c_str()){}
+    SqliteStmt(const SqliteStmt&) = delete;
+    SqliteStmt& operator=(const SqliteStmt&) = delete;
     ~SqliteStmt()
     {
         if (mStmt)
-            sqlite3_finalize(mStmt);
+            mDb.mStmtCache.put(mSql, mStmt);
     }
     operator sqlite3_stmt*() { return mStmt; }
     operator const sqlite3_stmt*() const {return mStmt; }
@@ -13,7 +13,7 @@ CREATE TABLE chats(chatid int64 unique primary key, shard tinyint,
     own_priv tinyint, peer int64 default -1, peer_priv tinyint default 0,
     title text, ts_created int64 not null default 0,
     last_seen int64 default 0, last_recv int64 default 0, archived tinyint default 0,
-    mode tinyint default 0, unified_key blob, rsn blob);
+    mode tinyint default 0, unified_key blob, rsn blob, unread_count int);
 
 CREATE TABLE contacts(userid int64 PRIMARY KEY, email text, visibility int,
     since int64 not null default 0);
@@ -32,6 +32,14 @@ CREATE TABLE history(idx int not null, chatid int64 not null, msgid int64 not nu
     userid int64, keyid int not null, type tinyint, updated smallint, ts int,
     is_encrypted tinyint, data blob, backrefid int64 not null, UNIQUE(chatid,msgid), UNIQUE(chatid,idx));
 
+CREATE INDEX history_unread ON history(chatid, idx, userid, is_encrypted)
+    WHERE type IN (1, 101, 103, 104, 105) AND NOT (updated != 0 AND length(data) = 0);
+
+CREATE INDEX history_last_text ON history(chatid, idx)
+    WHERE (length(data) > 0 OR type = 3) AND type != 102 AND type != 0;
+
+CREATE INDEX history_call_end ON history(chatid, idx) WHERE type = 6;
+
 CREATE TABLE sendkeys(chatid int64 not null, userid int64 not null, keyid int64 not null, key blob not null,
     ts int not null, UNIQUE(chatid, userid, keyid));
 
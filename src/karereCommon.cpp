@@ -14,7 +14,7 @@ namespace rtcModule {void globalCleanup(); }
 
 namespace karere
 {
-const char* gDbSchemaVersionSuffix = "9";
+const char* gDbSchemaVersionSuffix = "10";
 /*
     2 --> +3: invalidate cached chats to reload history (so call-history msgs are fetched)
     3 --> +4: invalidate both caches, SDK + MEGAchat, if there's at least one chat (so deleted chats are re-fetched from API)
@@ -24,6 +24,7 @@ const char* gDbSchemaVersionSuffix = "9";
     6 --> +7: update keyid for truncate messages in db
     7 --> +8: modify chats and create a new table chat_reactions
     8 --> +9: create table DNS cache
+    9 --> +10: add the unread count to chats and partial indexes to history
 */
 
 bool gCatchException = true;
@@ -6,6 +6,7 @@
 #include <set>
 #include "base64url.h"
 #include <buffer.h>
+#include <logger.h>
 
 namespace karere
 {
@@ -53,6 +54,15 @@ static inline std::string& operator+(std::string&& str, const Id& id)
     return str;
 }
 
+//for deferred log records, the id is formatted as in Id::toString()
+inline LogArg makeLogArg(const Id& id)
+{
+    LogArg arg;
+    arg.type = LogArg::kHandle;
+    arg.u = id.val;
+    return arg;
+}
+
 struct SetOfIds: public std::set<karere::Id>
 {
     typedef std::set<karere::Id> Base;
@@ -292,6 +292,11 @@ void MegaChatApi::setLogToConsole(bool enable)
     MegaChatApiImpl::setLogToConsole(enable);
 }
 
+void MegaChatApi::setLogAsync(bool enable)
+{
+    MegaChatApiImpl::setLogAsync(enable);
+}
+
 int MegaChatApi::init(const char *sid)
 {
     return pImpl->init(sid);
@@ -377,6 +382,21 @@ void MegaChatApi::setOnlineStatus(int status, MegaChatRequestListener *listener)
     pImpl->setOnlineStatus(status, listener);
 }
 
+void MegaChatApi::setOnlineStatusCoalescing(unsigned int periodMs)
+{
+    pImpl->setOnlineStatusCoalescing(periodMs);
+}
+
+void MegaChatApi::setLazyChatInit(bool enable)
+{
+    pImpl->setLazyChatInit(enable);
+}
+
+void MegaChatApi::setHistoryResidentLimits(unsigned int perChat, unsigned int total)
+{
+    pImpl->setHistoryResidentLimits(perChat, total);
+}
+
 void MegaChatApi::setPresenceAutoaway(bool enable, int64_t timeout, MegaChatRequestListener *listener)
 {
     pImpl->setPresenceAutoaway(enable, timeout, listener);
@@ -959,6 +979,11 @@ void MegaChatApi::removeChatRemoteVideoListener(MegaChatHandle chatid, MegaChatH
     pImpl->removeChatVideoListener(chatid, peerid, clientid, listener);
 }
 
+void MegaChatApi::releaseVideoBuffer(char *buffer)
+{
+    pImpl->releaseVideoBuffer(buffer);
+}
+
 #endif
 
 void MegaChatApi::setCatchException(bool enable)
@@ -1399,6 +1424,23 @@ void MegaChatVideoListener::onChatVideoData(MegaChatApi * /*api*/, MegaChatHandl
 
 }
 
+bool MegaChatVideoListener::retainsVideoBuffers()
+{
+    return false;
+}
+
+int MegaChatVideoListener::getVideoFormat()
+{
+    return VIDEO_FORMAT_ARGB;
+}
+
+void MegaChatVideoListener::onChatVideoI420Data(MegaChatApi * /*api*/, MegaChatHandle /*chatid*/, int /*width*/, int /*height*/,
+                                                const char * /*dataY*/, int /*strideY*/, const char * /*dataU*/, int /*strideU*/,
+                                                const char * /*dataV*/, int /*strideV*/, int /*rotation*/)
+{
+
+}
+
 
 void MegaChatCallListener::onChatCallUpdate(MegaChatApi * /*api*/, MegaChatCall * /*call*/)
 {
@@ -1425,6 +1467,14 @@ void MegaChatListener::onChatOnlineStatusUpdate(MegaChatApi* /*api*/, MegaChatHa
 
 }
 
+void MegaChatListener::onChatOnlineStatusesUpdate(MegaChatApi* api, MegaChatOnlineStatusList *statuses)
+{
+    for (unsigned int i = 0; i < statuses->size(); i++)
+    {
+        onChatOnlineStatusUpdate(api, statuses->getUserHandle(i), statuses->getOnlineStatus(i), false);
+    }
+}
+
 void MegaChatListener::onChatPresenceConfigUpdate(MegaChatApi * /*api*/, MegaChatPresenceConfig * /*config*/)
 {
 
@@ -1796,6 +1846,26 @@ unsigned int MegaChatListItemList::size() const
     return 0;
 }
 
+MegaChatOnlineStatusList *MegaChatOnlineStatusList::copy() const
+{
+    return NULL;
+}
+
+MegaChatHandle MegaChatOnlineStatusList::getUserHandle(unsigned int /*i*/) const
+{
+    return MEGACHAT_INVALID_HANDLE;
+}
+
+int MegaChatOnlineStatusList::getOnlineStatus(unsigned int /*i*/) const
+{
+    return MegaChatApi::STATUS_INVALID;
+}
+
+unsigned int MegaChatOnlineStatusList::size() const
+{
+    return 0;
+}
+
 MegaChatPresenceConfig *MegaChatPresenceConfig::copy() const
 {
     return NULL;
@@ -57,6 +57,7 @@ class MegaChatVideoListener;
 class MegaChatListener;
 class MegaChatNotificationListener;
 class MegaChatListItem;
+class MegaChatOnlineStatusList;
 class MegaChatNodeHistoryListener;
 
 /**
@@ -704,6 +705,12 @@ public:
 class MegaChatVideoListener
 {
 public:
+    enum
+    {
+        VIDEO_FORMAT_ARGB = 0,  /// Frames are received by onChatVideoData
+        VIDEO_FORMAT_I420 = 1,  /// Frames are received by onChatVideoI420Data
+    };
+
     virtual ~MegaChatVideoListener() {}
 
     /**
@@ -716,9 +723,65 @@ public:
      * @param buffer Data buffer in format ARGB: 4 bytes per pixel (total size: width * height * 4)
      * @param size Buffer size in bytes
      *
-     *  The MegaChatVideoListener retains the ownership of the buffer.
+     * The SDK retains the ownership of the buffer. It's valid until this function returns,
+     * unless MegaChatVideoListener::retainsVideoBuffers returns true.
      */
     virtual void onChatVideoData(MegaChatApi *api, MegaChatHandle chatid, int width, int height, char *buffer, size_t size);
+
+    /**
+     * @brief Returns whether this listener keeps the buffers received by onChatVideoData
+     *
+     * If it returns true, the buffer received by MegaChatVideoListener::onChatVideoData remains
+     * valid after that function returns, until the app calls MegaChatApi::releaseVideoBuffer.
+     * Released buffers are reused for next frames of the same size, so the app can render
+     * them without copying and without allocations per frame.
+     *
+     * This function is called for every frame, from the same thread that calls onChatVideoData.
+     * The default implementation returns false.
+     *
+     * @return True if the listener returns the buffers with MegaChatApi::releaseVideoBuffer
+     */
+    virtual bool retainsVideoBuffers();
+
+    /**
+     * @brief Returns the format of the frames this listener receives
+     *
+     * Valid values are:
+     *  - VIDEO_FORMAT_ARGB: frames are converted to ARGB, already rotated, and received
+     *  by MegaChatVideoListener::onChatVideoData. This is the default.
+     *  - VIDEO_FORMAT_I420: frames are received by MegaChatVideoListener::onChatVideoI420Data
+     *  as planar YUV 4:2:0, as they are decoded. It's intended for apps that upload YUV
+     *  textures, since no conversion nor rotation is applied.
+     *
+     * This function is called for every frame, from the same thread that delivers it.
+     *
+     * @return Format of the frames received by this listener
+     */
+    virtual int getVideoFormat();
+
+    /**
+     * @brief This function is called when a new image in I420 format is available
+     *
+     * It's only called if MegaChatVideoListener::getVideoFormat returns VIDEO_FORMAT_I420.
+     * The chroma planes (U and V) have a size of (width + 1) / 2 x (height + 1) / 2 pixels.
+     *
+     * The SDK retains the ownership of the planes. They are valid until this function returns.
+     *
+     * @param api MegaChatApi connected to the account
+     * @param chatid MegaChatHandle that provides the video
+     * @param width Size in pixels
+     * @param height Size in pixels
+     * @param dataY Luma plane
+     * @param strideY Size in bytes of each row of the luma plane
+     * @param dataU Blue chroma plane
+     * @param strideU Size in bytes of each row of the blue chroma plane
+     * @param dataV Red chroma plane
+     * @param strideV Size in bytes of each row of the red chroma plane
+     * @param rotation Clockwise rotation in degrees (0, 90, 180 or 270) to display the image with
+     */
+    virtual void onChatVideoI420Data(MegaChatApi *api, MegaChatHandle chatid, int width, int height,
+                                     const char *dataY, int strideY, const char *dataU, int strideU,
+                                     const char *dataV, int strideV, int rotation);
 };
 
 /**
@@ -928,6 +991,49 @@ public:
 
 };
 
+/**
+ * @brief List of online status changes of users
+ *
+ * A MegaChatOnlineStatusList is received in MegaChatListener::onChatOnlineStatusesUpdate when
+ * the online status changes are coalesced (see MegaChatApi::setOnlineStatusCoalescing). It
+ * contains the latest online status of every user whose status has changed, once per user.
+ *
+ * Objects of this class are immutable.
+ */
+class MegaChatOnlineStatusList
+{
+public:
+    virtual ~MegaChatOnlineStatusList() {}
+
+    virtual MegaChatOnlineStatusList *copy() const;
+
+    /**
+     * @brief Returns the handle of the user at the position i in the list
+     *
+     * If the index is >= the size of the list, this function returns MEGACHAT_INVALID_HANDLE.
+     *
+     * @param i Position of the user in the list
+     * @return MegaChatHandle of the user at the position i in the list
+     */
+    virtual MegaChatHandle getUserHandle(unsigned int i) const;
+
+    /**
+     * @brief Returns the online status of the user at the position i in the list
+     *
+     * If the index is >= the size of the list, this function returns MegaChatApi::STATUS_INVALID.
+     *
+     * @param i Position of the user in the list
+     * @return Online status of the user at the position i in the list
+     */
+    virtual int getOnlineStatus(unsigned int i) const;
+
+    /**
+     * @brief Returns the number of users in the list
+     * @return Number of users in the list
+     */
+    virtual unsigned int size() const;
+};
+
 /**
  * @brief This class store rich preview data
  *
@@ -2289,6 +2395,21 @@ public:
      */
     static void setLogToConsole(bool enable);
 
+    /**
+     * @brief Enable the asynchronous logging
+     *
+     * When enabled, log messages are queued and written to the console, the log file and
+     * the MegaChatLogger by a dedicated thread, so the threads of MEGAchat don't block on
+     * the log I/O. In consequence, MegaChatLogger::log is called from that thread. If
+     * messages are generated faster than they can be written, some of them are dropped
+     * and a message with the number of dropped messages is logged afterwards.
+     *
+     * By default, asynchronous logging is disabled.
+     *
+     * @param enable True to enable it, false to disable.
+     */
+    static void setLogAsync(bool enable);
+
     /**
      * @brief Initializes karere
      *
@@ -2599,6 +2720,51 @@ public:
      */
     void setOnlineStatus(int status, MegaChatRequestListener *listener = NULL);
 
+    /**
+     * @brief Coalesces the changes of online status of other users over a period
+     *
+     * By default, every change of online status of a contact is notified immediately
+     * by MegaChatListener::onChatOnlineStatusUpdate. When a period is set, the changes
+     * received during that period are notified at its end in a single call to
+     * MegaChatListener::onChatOnlineStatusesUpdate, with the latest status of every user.
+     * This reduces the number of callbacks for accounts with many contacts.
+     *
+     * Changes of your own online status are always notified immediately.
+     *
+     * @param periodMs Period in milliseconds. Zero to disable the coalescing (default)
+     */
+    void setOnlineStatusCoalescing(unsigned int periodMs);
+
+    /**
+     * @brief Enable/disable the lazy initialization of chatrooms
+     *
+     * By default, the chatrooms resumed from the local cache load their latest messages
+     * and their keys from the cache during the initialization. When enabled, this is
+     * deferred until the chatroom is opened (see MegaChatApi::openChatRoom) or a message
+     * is sent to it, which reduces the startup time and memory usage for accounts with
+     * many chatrooms.
+     *
+     * It must be called before MegaChatApi::init in order to apply to the cached chatrooms.
+     *
+     * @param enable True to enable the lazy initialization, false to disable it (default)
+     */
+    void setLazyChatInit(bool enable);
+
+    /**
+     * @brief Sets the limits of messages kept in memory for the chatrooms
+     *
+     * Messages beyond the limits are released from memory, but remain in the local cache,
+     * so they are loaded again when needed (i.e. MegaChatApi::loadMessages or
+     * MegaChatApi::getMessage). By default, 1024 messages are kept per chatroom, plus the
+     * older messages loaded by the app while it's viewing them, and there is no limit
+     * across all the chatrooms.
+     *
+     * @param perChat Messages kept per chatroom. Zero to keep all of them
+     * @param total Messages kept across all chatrooms. When exceeded, the chatrooms keep
+     * fewer messages than \c perChat. Zero for no limit
+     */
+    void setHistoryResidentLimits(unsigned int perChat, unsigned int total);
+
     /**
      * @brief Enable/disable the autoaway option, with one specific timeout
      *
@@ -4891,6 +5057,18 @@ public:
      * @param listener Object that is unregistered
      */
     void removeChatRemoteVideoListener(MegaChatHandle chatid, MegaChatHandle peerid, MegaChatHandle clientid, MegaChatVideoListener *listener);
+
+    /**
+     * @brief Returns a video buffer kept by a MegaChatVideoListener
+     *
+     * It must be called once for every buffer received by MegaChatVideoListener::onChatVideoData
+     * when MegaChatVideoListener::retainsVideoBuffers returns true. The buffer must not be
+     * accessed after this call. It can be called from any thread, even after the video
+     * listener has been removed.
+     *
+     * @param buffer Buffer received by MegaChatVideoListener::onChatVideoData
+     */
+    void releaseVideoBuffer(char *buffer);
 #endif
 
     static void setCatchException(bool enable);
@@ -5586,6 +5764,20 @@ public:
      */
     virtual void onChatOnlineStatusUpdate(MegaChatApi* api, MegaChatHandle userhandle, int status, bool inProgress);
 
+    /**
+     * @brief This function is called with the coalesced changes of online status of other users
+     *
+     * It's only called when MegaChatApi::setOnlineStatusCoalescing has been enabled. The
+     * default implementation calls MegaChatListener::onChatOnlineStatusUpdate for every change.
+     *
+     * The SDK retains the ownership of the MegaChatOnlineStatusList. It will be only valid
+     * until this function returns. Use MegaChatOnlineStatusList::copy to keep it.
+     *
+     * @param api MegaChatApi connected to the account
+     * @param statuses Latest online status of every user whose status has changed
+     */
+    virtual void onChatOnlineStatusesUpdate(MegaChatApi* api, MegaChatOnlineStatusList *statuses);
+
     /**
      * @brief This function is called when the presence configuration has changed
      *
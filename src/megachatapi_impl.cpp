@@ -343,6 +343,7 @@ void MegaChatApiImpl::sendPendingRequests()
             bool deleteDb = request->getFlag();
             cleanChatHandlers();
             terminating = true;
+            resetChatListSnapshot();
             mClient->terminate(deleteDb);
 
             API_LOG_INFO("Chat engine is logged out!");
@@ -363,6 +364,7 @@ void MegaChatApiImpl::sendPendingRequests()
             if (mClient && !terminating)
             {
                 cleanChatHandlers();
+                resetChatListSnapshot();
                 mClient->terminate();
                 API_LOG_INFO("Chat engine closed!");
 
@@ -1368,7 +1370,7 @@ void MegaChatApiImpl::sendPendingRequests()
                         // first msg to consider: last-seen if loaded in memory. Otherwise, the oldest loaded msg
                         Idx first = chat.lownum();
                         if (lastSeenIdx != CHATD_IDX_INVALID        // message is known locally
-                                && chat.findOrNull(lastSeenIdx))    // message is loaded in RAM
+                                && chat.findInRam(lastSeenIdx))     // message is loaded in RAM
                         {
                             first = lastSeenIdx + 1;
                         }
@@ -1863,6 +1865,11 @@ void MegaChatApiImpl::setLogToConsole(bool enable)
     }
 }
 
+void MegaChatApiImpl::setLogAsync(bool enable)
+{
+    gLogger.logAsync(enable);
+}
+
 void MegaChatApiImpl::setLoggerClass(MegaChatLogger *megaLogger)
 {
     if (!megaLogger)   // removing logger
@@ -1934,6 +1941,9 @@ void MegaChatApiImpl::createKarereClient()
         uint8_t caps = karere::kClientIsMobile | karere::kClientSupportLastGreen;
 #endif
         mClient = new karere::Client(*megaApi, websocketsIO, *this, megaApi->getBasePath(), caps, this);
+        mClient->presenced().setPresenceCoalescing(mOnlineStatusCoalescing);
+        mClient->setLazyChatInit(mLazyChatInit);
+        mClient->setHistoryResidentLimits(mHistoryResidentWindow, mHistoryResidentCap);
         terminating = false;
     }
 }
@@ -2039,7 +2049,7 @@ chatd::Message *MegaChatApiImpl::findMessage(MegaChatHandle chatid, MegaChatHand
     if (chatroom)
     {
         Chat &chat = chatroom->chat();
-        Idx index = chat.msgIndexFromId(msgid);
+        Idx index = chat.msgIndexFromIdOrDb(msgid);
         if (index != CHATD_IDX_INVALID)
         {
             msg = chat.findOrNull(index);
@@ -2345,7 +2355,7 @@ void MegaChatApiImpl::fireOnChatSessionUpdate(MegaChatHandle chatid, MegaChatHan
     session->removeChanges();
 }
 
-void MegaChatApiImpl::fireOnChatVideoData(MegaChatHandle chatid, MegaChatHandle peerid, uint32_t clientid, int width, int height, char *buffer)
+void MegaChatApiImpl::fireOnChatVideoData(MegaChatHandle chatid, MegaChatHandle peerid, uint32_t clientid, MegaChatVideoFrame *frame)
 {
     std::map<MegaChatHandle, MegaChatPeerVideoListener_map>::iterator it = videoListeners.find(chatid);
     if (it != videoListeners.end())
@@ -2353,20 +2363,81 @@ void MegaChatApiImpl::fireOnChatVideoData(MegaChatHandle chatid, MegaChatHandle
         MegaChatPeerVideoListener_map::iterator peerVideoIterator = it->second.find(EndpointId(peerid, clientid));
         if (peerVideoIterator != it->second.end())
         {
+            char *buffer = (char *)frame->buffer;
             for( MegaChatVideoListener_set::iterator videoListenerIterator = peerVideoIterator->second.begin();
                  videoListenerIterator != peerVideoIterator->second.end();
                  videoListenerIterator++)
             {
-                (*videoListenerIterator)->onChatVideoData(chatApi, chatid, width, height, buffer, width * height * 4);
+                if ((*videoListenerIterator)->getVideoFormat() != MegaChatVideoListener::VIDEO_FORMAT_ARGB)
+                {
+                    continue;
+                }
+
+                if ((*videoListenerIterator)->retainsVideoBuffers())
+                {
+                    // the buffer is not reused until the listener calls releaseVideoBuffer()
+                    frame->refs++;
+                    auto &retained = retainedVideoFrames[buffer];
+                    retained.first = frame;
+                    retained.second++;
+                }
+                (*videoListenerIterator)->onChatVideoData(chatApi, chatid, frame->width, frame->height, buffer, frame->width * frame->height * 4);
+            }
+        }
+    }
+}
+
+void MegaChatApiImpl::fireOnChatVideoI420Data(MegaChatHandle chatid, MegaChatHandle peerid, uint32_t clientid, const rtcModule::IVideoRenderer::I420Frame &frame)
+{
+    std::map<MegaChatHandle, MegaChatPeerVideoListener_map>::iterator it = videoListeners.find(chatid);
+    if (it != videoListeners.end())
+    {
+        MegaChatPeerVideoListener_map::iterator peerVideoIterator = it->second.find(EndpointId(peerid, clientid));
+        if (peerVideoIterator != it->second.end())
+        {
+            for( MegaChatVideoListener_set::iterator videoListenerIterator = peerVideoIterator->second.begin();
+                 videoListenerIterator != peerVideoIterator->second.end();
+                 videoListenerIterator++)
+            {
+                if ((*videoListenerIterator)->getVideoFormat() == MegaChatVideoListener::VIDEO_FORMAT_I420)
+                {
+                    (*videoListenerIterator)->onChatVideoI420Data(chatApi, chatid, frame.width, frame.height,
+                                                                  (const char *)frame.dataY, frame.strideY,
+                                                                  (const char *)frame.dataU, frame.strideU,
+                                                                  (const char *)frame.dataV, frame.strideV,
+                                                                  frame.rotation);
+                }
+            }
+        }
+    }
+}
+
+int MegaChatApiImpl::getVideoFormats(MegaChatHandle chatid, MegaChatHandle peerid, uint32_t clientid)
+{
+    int formats = 0;
+    std::map<MegaChatHandle, MegaChatPeerVideoListener_map>::iterator it = videoListeners.find(chatid);
+    if (it != videoListeners.end())
+    {
+        MegaChatPeerVideoListener_map::iterator peerVideoIterator = it->second.find(EndpointId(peerid, clientid));
+        if (peerVideoIterator != it->second.end())
+        {
+            for (MegaChatVideoListener *listener : peerVideoIterator->second)
+            {
+                formats |= (listener->getVideoFormat() == MegaChatVideoListener::VIDEO_FORMAT_I420)
+                        ? rtcModule::IVideoRenderer::kFormatI420
+                        : rtcModule::IVideoRenderer::kFormatArgb;
             }
         }
     }
+    return formats;
 }
 
 #endif  // webrtc
 
 void MegaChatApiImpl::fireOnChatListItemUpdate(MegaChatListItem *item)
 {
+    invalidateChatListSnapshot(item->getChatId());
+
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
     {
         (*it)->onChatListItemUpdate(chatApi, item);
@@ -2391,6 +2462,16 @@ void MegaChatApiImpl::fireOnChatOnlineStatusUpdate(MegaChatHandle userhandle, in
     }
 }
 
+void MegaChatApiImpl::fireOnChatOnlineStatusesUpdate(MegaChatOnlineStatusList *statuses)
+{
+    for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
+    {
+        (*it)->onChatOnlineStatusesUpdate(chatApi, statuses);
+    }
+
+    delete statuses;
+}
+
 void MegaChatApiImpl::fireOnChatPresenceConfigUpdate(MegaChatPresenceConfig *config)
 {
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
@@ -2633,6 +2714,46 @@ int MegaChatApiImpl::getUserOnlineStatus(MegaChatHandle userhandle)
     return status;
 }
 
+void MegaChatApiImpl::setOnlineStatusCoalescing(unsigned int periodMs)
+{
+    sdkMutex.lock();
+
+    mOnlineStatusCoalescing = periodMs;
+    if (mClient)
+    {
+        mClient->presenced().setPresenceCoalescing(periodMs);
+    }
+
+    sdkMutex.unlock();
+}
+
+void MegaChatApiImpl::setLazyChatInit(bool enable)
+{
+    sdkMutex.lock();
+
+    mLazyChatInit = enable;
+    if (mClient)
+    {
+        mClient->setLazyChatInit(enable);
+    }
+
+    sdkMutex.unlock();
+}
+
+void MegaChatApiImpl::setHistoryResidentLimits(unsigned int perChat, unsigned int total)
+{
+    sdkMutex.lock();
+
+    mHistoryResidentWindow = perChat;
+    mHistoryResidentCap = total;
+    if (mClient)
+    {
+        mClient->setHistoryResidentLimits(perChat, total);
+    }
+
+    sdkMutex.unlock();
+}
+
 void MegaChatApiImpl::setBackgroundStatus(bool background, MegaChatRequestListener *listener)
 {
     MegaChatRequestPrivate *request = new MegaChatRequestPrivate(MegaChatRequest::TYPE_SET_BACKGROUND_STATUS, listener);
@@ -2775,23 +2896,91 @@ char *MegaChatApiImpl::getMyEmail()
     return MegaApi::strdup(mClient->myEmail().c_str());
 }
 
-MegaChatRoomList *MegaChatApiImpl::getChatRooms()
+std::shared_ptr<const ChatListSnapshot> MegaChatApiImpl::chatListSnapshot()
 {
-    MegaChatRoomListPrivate *chats = new MegaChatRoomListPrivate();
+    std::shared_ptr<const ChatListSnapshot> snapshot = std::atomic_load(&mChatListSnapshot);
+    if (snapshot)
+    {
+        return snapshot;
+    }
 
     sdkMutex.lock();
 
-    if (mClient && !terminating)
+    // another thread may have built it while waiting for the lock
+    snapshot = std::atomic_load(&mChatListSnapshot);
+    if (!snapshot && mClient && !terminating)
     {
+        std::shared_ptr<ChatListSnapshot> newSnapshot = std::make_shared<ChatListSnapshot>();
+        newSnapshot->entries.reserve(mClient->chats->size());
+
+        // both lists are sorted by chatid, so entries of unchanged chats can be reused in one pass
+        const ChatListSnapshot *last = mLastChatListSnapshot.get();
+        size_t i = 0;
         ChatRoomList::iterator it;
         for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
         {
-            chats->addChatRoom(new MegaChatRoomPrivate(*it->second));
+            MegaChatHandle chatid = it->first;
+            while (last && i < last->entries.size() && last->entries[i].chatid < chatid)
+            {
+                i++;
+            }
+
+            if (last && i < last->entries.size() && last->entries[i].chatid == chatid
+                    && mChangedChatListEntries.find(chatid) == mChangedChatListEntries.end())
+            {
+                newSnapshot->entries.push_back(last->entries[i]);
+            }
+            else
+            {
+                ChatListSnapshot::Entry entry;
+                entry.chatid = chatid;
+                entry.room = std::make_shared<MegaChatRoomPrivate>(*it->second);
+                entry.item = std::make_shared<MegaChatListItemPrivate>(*it->second);
+                newSnapshot->entries.push_back(entry);
+            }
         }
+
+        mChangedChatListEntries.clear();
+        mLastChatListSnapshot = newSnapshot;
+        snapshot = mLastChatListSnapshot;
+        std::atomic_store(&mChatListSnapshot, snapshot);
     }
 
     sdkMutex.unlock();
 
+    return snapshot;
+}
+
+void MegaChatApiImpl::invalidateChatListSnapshot(MegaChatHandle chatid)
+{
+    sdkMutex.lock();
+    mChangedChatListEntries.insert(chatid);
+    std::atomic_store(&mChatListSnapshot, std::shared_ptr<const ChatListSnapshot>());
+    sdkMutex.unlock();
+}
+
+void MegaChatApiImpl::resetChatListSnapshot()
+{
+    sdkMutex.lock();
+    std::atomic_store(&mChatListSnapshot, std::shared_ptr<const ChatListSnapshot>());
+    mLastChatListSnapshot.reset();
+    mChangedChatListEntries.clear();
+    sdkMutex.unlock();
+}
+
+MegaChatRoomList *MegaChatApiImpl::getChatRooms()
+{
+    std::shared_ptr<const ChatListSnapshot> snapshot = chatListSnapshot();
+    if (!snapshot)
+    {
+        return new MegaChatRoomListPrivate();
+    }
+
+    MegaChatRoomListPrivate *chats = new MegaChatRoomListPrivate(snapshot);
+    for (auto &entry : snapshot->entries)
+    {
+        chats->addChatRoom(entry.room.get());
+    }
     return chats;
 }
 
@@ -2831,81 +3020,70 @@ MegaChatRoom *MegaChatApiImpl::getChatRoomByUser(MegaChatHandle userhandle)
 
 MegaChatListItemList *MegaChatApiImpl::getChatListItems()
 {
-    MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
-
-    sdkMutex.lock();
+    std::shared_ptr<const ChatListSnapshot> snapshot = chatListSnapshot();
+    if (!snapshot)
+    {
+        return new MegaChatListItemListPrivate();
+    }
 
-    if (mClient && !terminating)
+    MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate(snapshot);
+    for (auto &entry : snapshot->entries)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        if (!entry.item->isArchived())
         {
-            if (!it->second->isArchived())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
+            items->addChatListItem(entry.item.get());
         }
     }
-
-    sdkMutex.unlock();
-
     return items;
 }
 
 MegaChatListItemList *MegaChatApiImpl::getChatListItemsByPeers(MegaChatPeerList *peers)
 {
-    MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
-
-    sdkMutex.lock();
+    std::shared_ptr<const ChatListSnapshot> snapshot = chatListSnapshot();
+    if (!snapshot)
+    {
+        return new MegaChatListItemListPrivate();
+    }
 
-    if (mClient && !terminating)
+    MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate(snapshot);
+    for (auto &entry : snapshot->entries)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        const MegaChatRoomPrivate *room = entry.room.get();
+        if (room->isGroup())
         {
-            bool sameParticipants = true;
-            if (it->second->isGroup())
+            if ((int)room->getPeerCount() != peers->size())
             {
-                GroupChatRoom *chatroom = (GroupChatRoom*) it->second;
-                if ((int)chatroom->peers().size() != peers->size())
-                {
-                    continue;
-                }
+                continue;
+            }
 
-                for (int i = 0; i < peers->size(); i++)
+            bool sameParticipants = true;
+            for (int j = 0; j < peers->size() && sameParticipants; j++)
+            {
+                // if the peer in the list is part of the members in the chatroom...
+                MegaChatHandle uh = peers->getPeerHandle(j);
+                sameParticipants = false;
+                for (unsigned int k = 0; k < room->getPeerCount(); k++)
                 {
-                    // if the peer in the list is part of the members in the chatroom...
-                    MegaChatHandle uh = peers->getPeerHandle(i);
-                    if (chatroom->peers().find(uh) == chatroom->peers().end())
+                    if (room->getPeerHandle(k) == uh)
                     {
-                        sameParticipants = false;
+                        sameParticipants = true;
                         break;
                     }
                 }
-                if (sameParticipants == true)
-                {
-                    items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-                }
-
             }
-            else    // 1on1
+            if (sameParticipants)
             {
-                if (peers->size() != 1)
-                {
-                    continue;
-                }
-
-                PeerChatRoom *chatroom = (PeerChatRoom*) it->second;
-                if (chatroom->peer() == peers->getPeerHandle(0))
-                {
-                    items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-                }
+                items->addChatListItem(entry.item.get());
+            }
+        }
+        else    // 1on1
+        {
+            if (peers->size() == 1 && room->getPeerHandle(0) == peers->getPeerHandle(0))
+            {
+                items->addChatListItem(entry.item.get());
             }
         }
     }
-
-    sdkMutex.unlock();
-
     return items;
 }
 
@@ -3300,7 +3478,7 @@ MegaChatMessage *MegaChatApiImpl::getMessage(MegaChatHandle chatid, MegaChatHand
     if (chatroom)
     {
         Chat &chat = chatroom->chat();
-        Idx index = chat.msgIndexFromId(msgid);
+        Idx index = chat.msgIndexFromIdOrDb(msgid);
         if (index != CHATD_IDX_INVALID)     // only confirmed messages have index
         {
             Message *msg = chat.findOrNull(index);
@@ -3481,7 +3659,7 @@ MegaChatMessage *MegaChatApiImpl::forwardContact(MegaChatHandle sourceChatid, Me
     if (chatroomSource && chatroomTarget)
     {
         chatd::Chat &chat = chatroomSource->chat();
-        Idx idx =  chat.msgIndexFromId(msgid);
+        Idx idx =  chat.msgIndexFromIdOrDb(msgid);
         chatd::Message *msg = chatroomSource->chat().findOrNull(idx);
         if (msg && msg->type == chatd::Message::kMsgContact)
         {
@@ -4213,6 +4391,26 @@ void MegaChatApiImpl::removeChatVideoListener(MegaChatHandle chatid, MegaChatHan
     videoMutex.unlock();
 }
 
+void MegaChatApiImpl::releaseVideoBuffer(char *buffer)
+{
+    videoMutex.lock();
+    auto it = retainedVideoFrames.find(buffer);
+    if (it == retainedVideoFrames.end())
+    {
+        videoMutex.unlock();
+        API_LOG_WARNING("releaseVideoBuffer: unknown video buffer");
+        return;
+    }
+
+    MegaChatVideoFrame *frame = it->second.first;
+    if (--it->second.second == 0)
+    {
+        retainedVideoFrames.erase(it);
+    }
+    videoMutex.unlock();
+    frame->release();
+}
+
 #endif  // webrtc
 
 void MegaChatApiImpl::removeChatListener(MegaChatListener *listener)
@@ -4277,7 +4475,7 @@ MegaChatErrorPrivate *MegaChatApiImpl::addReaction(MegaChatHandle chatid, MegaCh
         else
         {
             Chat &chat = chatroom->chat();
-            Idx index = chat.msgIndexFromId(msgid);
+            Idx index = chat.msgIndexFromIdOrDb(msgid);
             if (index == CHATD_IDX_INVALID)
             {
                 errorCode = MegaChatError::ERROR_NOENT;
@@ -4329,7 +4527,7 @@ MegaChatErrorPrivate *MegaChatApiImpl::delReaction(MegaChatHandle chatid, MegaCh
         else
         {
             Chat &chat = chatroom->chat();
-            Idx index = chat.msgIndexFromId(msgid);
+            Idx index = chat.msgIndexFromIdOrDb(msgid);
             if (index == CHATD_IDX_INVALID)
             {
                 errorCode = MegaChatError::ERROR_NOENT;
@@ -4707,6 +4905,12 @@ void MegaChatApiImpl::onPresenceChanged(Id userid, Presence pres, bool inProgres
     fireOnChatOnlineStatusUpdate(userid.val, pres.status(), inProgress);
 }
 
+void MegaChatApiImpl::onPresencesChanged(const std::map<Id, Presence>& changes)
+{
+    API_LOG_INFO("Presence of %zu users has been changed", changes.size());
+    fireOnChatOnlineStatusesUpdate(new MegaChatOnlineStatusListPrivate(changes));
+}
+
 void MegaChatApiImpl::onPresenceConfigChanged(const presenced::Config &state, bool pending)
 {
     MegaChatPresenceConfigPrivate *config = new MegaChatPresenceConfigPrivate(state, pending);
@@ -4762,54 +4966,113 @@ void ChatRequestQueue::removeListener(MegaChatRequestListener *listener)
     mutex.unlock();
 }
 
-void EventQueue::push(void *transfer)
+EventQueue::EventQueue()
+    : mEnqueuePos(0), mDequeuePos(0), mOverflowing(false)
 {
-    mutex.lock();
-    events.push_back(transfer);
-    mutex.unlock();
+    static_assert((kCapacity & (kCapacity - 1)) == 0, "EventQueue capacity must be a power of 2");
+    mSlots = new Slot[kCapacity];
+    for (size_t i = 0; i < kCapacity; i++)
+    {
+        mSlots[i].seq.store(i, std::memory_order_relaxed);
+        mSlots[i].event = NULL;
+    }
 }
 
-void EventQueue::push_front(void *event)
+EventQueue::~EventQueue()
 {
-    mutex.lock();
-    events.push_front(event);
-    mutex.unlock();
+    delete [] mSlots;
+}
+
+void EventQueue::push(void *event)
+{
+    // once an event has overflowed, the following ones must go after it
+    if (!mOverflowing.load(std::memory_order_acquire))
+    {
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = mSlots[pos & (kCapacity - 1)];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.event = event;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return;
+                }
+            }
+            else if (diff < 0) // the ring is full
+            {
+                break;
+            }
+            else
+            {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mOverflowMutex);
+    mOverflowing.store(true, std::memory_order_release);
+    mOverflow.push_back(event);
+}
+
+void* EventQueue::popFromRing()
+{
+    size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+    Slot &slot = mSlots[pos & (kCapacity - 1)];
+    if (slot.seq.load(std::memory_order_acquire) != pos + 1)
+    {
+        return NULL;    // empty, or the producer has not published the event yet
+    }
+
+    void *event = slot.event;
+    slot.seq.store(pos + kCapacity, std::memory_order_release);
+    mDequeuePos.store(pos + 1, std::memory_order_release);
+    return event;
 }
 
 void* EventQueue::pop()
 {
-    mutex.lock();
-    if(events.empty())
+    void *event = popFromRing();
+    if (event || !mOverflowing.load(std::memory_order_acquire))
     {
-        mutex.unlock();
+        return event;
+    }
+
+    std::lock_guard<std::mutex> lock(mOverflowMutex);
+
+    // events in the ring go first, even the ones still being published, since their threads may
+    // have overflowed later events (the producer notifies after publishing, so they aren't missed)
+    event = popFromRing();
+    if (event || mEnqueuePos.load(std::memory_order_acquire) != mDequeuePos.load(std::memory_order_relaxed))
+    {
+        return event;
+    }
+
+    if (mOverflow.empty())
+    {
+        mOverflowing.store(false, std::memory_order_release);
         return NULL;
     }
-    void* event = events.front();
-    events.pop_front();
-    mutex.unlock();
+    event = mOverflow.front();
+    mOverflow.pop_front();
     return event;
 }
 
 bool EventQueue::isEmpty()
 {
-    bool ret;
-
-    mutex.lock();
-    ret = events.empty();
-    mutex.unlock();
-
-    return ret;
+    return !size();
 }
 
 size_t EventQueue::size()
 {
-    size_t ret;
-
-    mutex.lock();
-    ret = events.size();
-    mutex.unlock();
+    size_t ret = mEnqueuePos.load(std::memory_order_acquire) - mDequeuePos.load(std::memory_order_acquire);
 
-    return ret;
+    std::lock_guard<std::mutex> lock(mOverflowMutex);
+    return ret + mOverflow.size();
 }
 
 MegaChatRequestPrivate::MegaChatRequestPrivate(int type, MegaChatRequestListener *listener)
@@ -5841,12 +6104,91 @@ void MegaChatCallPrivate::setCaller(Id caller)
     this->callerId = caller;
 }
 
+MegaChatVideoFrame::MegaChatVideoFrame(int width, int height)
+    : buffer(new ::mega::byte[width * height * 4]),  // in format ARGB: 4 bytes per pixel
+      width(width),
+      height(height),
+      refs(1)
+{
+}
+
+MegaChatVideoFrame::~MegaChatVideoFrame()
+{
+    delete [] buffer;
+}
+
+void MegaChatVideoFrame::release()
+{
+    if (--refs > 0)
+    {
+        return;
+    }
+
+    // keep the pool alive until the frame is returned, the receiver may be gone already
+    std::shared_ptr<MegaChatVideoFramePool> framePool = std::move(pool);
+    framePool->putFrame(this);
+}
+
+MegaChatVideoFramePool::~MegaChatVideoFramePool()
+{
+    for (MegaChatVideoFrame *frame : mFrames)
+    {
+        delete frame;
+    }
+}
+
+MegaChatVideoFrame *MegaChatVideoFramePool::getFrame(int width, int height)
+{
+    MegaChatVideoFrame *frame = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (width != mWidth || height != mHeight)
+        {
+            // resolution has changed, free buffers won't fit anymore
+            for (MegaChatVideoFrame *oldFrame : mFrames)
+            {
+                delete oldFrame;
+            }
+            mFrames.clear();
+            mWidth = width;
+            mHeight = height;
+        }
+        else if (!mFrames.empty())
+        {
+            frame = mFrames.back();
+            mFrames.pop_back();
+            frame->refs = 1;
+        }
+    }
+
+    if (!frame)
+    {
+        frame = new MegaChatVideoFrame(width, height);
+    }
+    frame->pool = shared_from_this();
+    return frame;
+}
+
+void MegaChatVideoFramePool::putFrame(MegaChatVideoFrame *frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (frame->width == mWidth && frame->height == mHeight && mFrames.size() < kMaxFrames)
+        {
+            mFrames.push_back(frame);
+            return;
+        }
+    }
+    delete frame;
+}
+
 MegaChatVideoReceiver::MegaChatVideoReceiver(MegaChatApiImpl *chatApi, rtcModule::ICall *call, MegaChatHandle peerid, uint32_t clientid)
 {
     this->chatApi = chatApi;
     chatid = call->chat().chatId();
     this->peerid = peerid;
     this->clientid = clientid;
+    framePool = std::make_shared<MegaChatVideoFramePool>();
 }
 
 MegaChatVideoReceiver::~MegaChatVideoReceiver()
@@ -5855,10 +6197,7 @@ MegaChatVideoReceiver::~MegaChatVideoReceiver()
 
 void* MegaChatVideoReceiver::getImageBuffer(unsigned short width, unsigned short height, void*& userData)
 {
-    MegaChatVideoFrame *frame = new MegaChatVideoFrame;
-    frame->width = width;
-    frame->height = height;
-    frame->buffer = new ::mega::byte[width * height * 4];  // in format ARGB: 4 bytes per pixel
+    MegaChatVideoFrame *frame = framePool->getFrame(width, height);
     userData = frame;
     return frame->buffer;
 }
@@ -5867,10 +6206,24 @@ void MegaChatVideoReceiver::frameComplete(void *userData)
 {
     chatApi->videoMutex.lock();
     MegaChatVideoFrame *frame = (MegaChatVideoFrame *)userData;
-    chatApi->fireOnChatVideoData(chatid, peerid, clientid, frame->width, frame->height, (char *)frame->buffer);
+    chatApi->fireOnChatVideoData(chatid, peerid, clientid, frame);
+    chatApi->videoMutex.unlock();
+    frame->release();
+}
+
+int MegaChatVideoReceiver::frameFormat()
+{
+    chatApi->videoMutex.lock();
+    int formats = chatApi->getVideoFormats(chatid, peerid, clientid);
+    chatApi->videoMutex.unlock();
+    return formats; // no listeners, no need to convert the frame
+}
+
+void MegaChatVideoReceiver::onI420Frame(const I420Frame &frame)
+{
+    chatApi->videoMutex.lock();
+    chatApi->fireOnChatVideoI420Data(chatid, peerid, clientid, frame);
     chatApi->videoMutex.unlock();
-    delete [] frame->buffer;
-    delete frame;
 }
 
 void MegaChatVideoReceiver::onVideoAttach()
@@ -5918,6 +6271,8 @@ void MegaChatRoomHandler::removeChatRoomListener(MegaChatRoomListener *listener)
 
 void MegaChatRoomHandler::fireOnChatRoomUpdate(MegaChatRoom *chat)
 {
+    chatApiImpl->invalidateChatListSnapshot(chat->getChatId());
+
     for(set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end() ; it++)
     {
         (*it)->onChatRoomUpdate(chatApi, chat);
@@ -6496,8 +6851,22 @@ MegaChatRoomListPrivate::MegaChatRoomListPrivate()
 
 }
 
+MegaChatRoomListPrivate::MegaChatRoomListPrivate(std::shared_ptr<const ChatListSnapshot> snapshot)
+    : mSnapshot(snapshot)
+{
+
+}
+
 MegaChatRoomListPrivate::MegaChatRoomListPrivate(const MegaChatRoomListPrivate *list)
 {
+    if (list->mSnapshot)
+    {
+        // rooms in the snapshot are immutable, no need to copy them
+        mSnapshot = list->mSnapshot;
+        this->list = list->list;
+        return;
+    }
+
     MegaChatRoomPrivate *chat;
 
     for (unsigned int i = 0; i < list->size(); i++)
@@ -8426,12 +8795,49 @@ MegaChatListItemListPrivate::MegaChatListItemListPrivate()
 {
 }
 
+MegaChatOnlineStatusListPrivate::MegaChatOnlineStatusListPrivate(const std::map<Id, Presence>& changes)
+{
+    list.reserve(changes.size());
+    for (auto& change: changes)
+    {
+        list.emplace_back(change.first.val, change.second.status());
+    }
+}
+
+MegaChatOnlineStatusListPrivate *MegaChatOnlineStatusListPrivate::copy() const
+{
+    return new MegaChatOnlineStatusListPrivate(*this);
+}
+
+MegaChatHandle MegaChatOnlineStatusListPrivate::getUserHandle(unsigned int i) const
+{
+    return (i < list.size()) ? list[i].first : MEGACHAT_INVALID_HANDLE;
+}
+
+int MegaChatOnlineStatusListPrivate::getOnlineStatus(unsigned int i) const
+{
+    return (i < list.size()) ? list[i].second : MegaChatApi::STATUS_INVALID;
+}
+
+unsigned int MegaChatOnlineStatusListPrivate::size() const
+{
+    return list.size();
+}
+
+MegaChatListItemListPrivate::MegaChatListItemListPrivate(std::shared_ptr<const ChatListSnapshot> snapshot)
+    : mSnapshot(snapshot)
+{
+}
+
 MegaChatListItemListPrivate::~MegaChatListItemListPrivate()
 {
-    for (unsigned int i = 0; i < list.size(); i++)
+    if (!mSnapshot)     // items owned by the snapshot are released with it
     {
-        delete list[i];
-        list[i] = NULL;
+        for (unsigned int i = 0; i < list.size(); i++)
+        {
+            delete list[i];
+            list[i] = NULL;
+        }
     }
 
     list.clear();
@@ -8439,6 +8845,14 @@ MegaChatListItemListPrivate::~MegaChatListItemListPrivate()
 
 MegaChatListItemListPrivate::MegaChatListItemListPrivate(const MegaChatListItemListPrivate *list)
 {
+    if (list->mSnapshot)
+    {
+        // items in the snapshot are immutable, no need to copy them
+        mSnapshot = list->mSnapshot;
+        this->list = list->list;
+        return;
+    }
+
     MegaChatListItemPrivate *item;
 
     for (unsigned int i = 0; i < list->size(); i++)
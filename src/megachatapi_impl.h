@@ -43,6 +43,7 @@
 #include <karereCommon.h>
 #include <logger.h>
 #include <stdint.h>
+#include <atomic>
 #include "net/libwebsocketsIO.h"
 #include "waiter/libuvWaiter.h"
 
@@ -290,12 +291,48 @@ protected:
     bool mIsCaller;
 };
 
+class MegaChatVideoFramePool;
+
 class MegaChatVideoFrame
 {
 public:
+    MegaChatVideoFrame(int width, int height);
+    ~MegaChatVideoFrame();
+
+    // drops a reference, the frame is returned to its pool when none is left
+    void release();
+
     unsigned char *buffer;
     int width;
     int height;
+
+    // pending releases: one for the receiver plus one per listener that retains the buffer
+    std::atomic<int> refs;
+
+    // set while the frame is in use, so it can be returned after the receiver is destroyed
+    std::shared_ptr<MegaChatVideoFramePool> pool;
+};
+
+/**
+ * @brief Recycles the frame buffers of a MegaChatVideoReceiver
+ *
+ * Free buffers are kept for the resolution of the latest frame, up to kMaxFrames.
+ * Buffers of any other resolution are freed when returned.
+ */
+class MegaChatVideoFramePool : public std::enable_shared_from_this<MegaChatVideoFramePool>
+{
+public:
+    static const size_t kMaxFrames = 4;
+
+    ~MegaChatVideoFramePool();
+    MegaChatVideoFrame *getFrame(int width, int height);
+    void putFrame(MegaChatVideoFrame *frame);
+
+protected:
+    std::mutex mMutex;
+    int mWidth = 0;
+    int mHeight = 0;
+    std::vector<MegaChatVideoFrame *> mFrames;
 };
 
 class MegaChatVideoReceiver : public rtcModule::IVideoRenderer
@@ -311,6 +348,8 @@ public:
     // rtcModule::IVideoRenderer implementation
     virtual void* getImageBuffer(unsigned short width, unsigned short height, void*& userData);
     virtual void frameComplete(void* userData);
+    virtual int frameFormat();
+    virtual void onI420Frame(const I420Frame& frame);
     virtual void onVideoAttach();
     virtual void onVideoDetach();
     virtual void clearViewport();
@@ -322,6 +361,7 @@ protected:
     MegaChatHandle chatid;
     MegaChatHandle peerid;
     uint32_t clientid;
+    std::shared_ptr<MegaChatVideoFramePool> framePool;
 };
 
 #endif
@@ -684,10 +724,14 @@ private:
     mega::userpriv_vector list;
 };
 
+struct ChatListSnapshot;
+
 class MegaChatListItemListPrivate :  public MegaChatListItemList
 {
 public:
     MegaChatListItemListPrivate();
+    // items added to the list are owned by the snapshot, which is kept alive by the list
+    MegaChatListItemListPrivate(std::shared_ptr<const ChatListSnapshot> snapshot);
     virtual ~MegaChatListItemListPrivate();
     virtual MegaChatListItemListPrivate *copy() const;
 
@@ -699,6 +743,21 @@ public:
 private:
     MegaChatListItemListPrivate(const MegaChatListItemListPrivate *list);
     std::vector<MegaChatListItem*> list;
+    std::shared_ptr<const ChatListSnapshot> mSnapshot;
+};
+
+class MegaChatOnlineStatusListPrivate : public MegaChatOnlineStatusList
+{
+public:
+    MegaChatOnlineStatusListPrivate(const std::map<karere::Id, karere::Presence>& changes);
+    virtual MegaChatOnlineStatusListPrivate *copy() const;
+
+    virtual MegaChatHandle getUserHandle(unsigned int i) const;
+    virtual int getOnlineStatus(unsigned int i) const;
+    virtual unsigned int size() const;
+
+private:
+    std::vector<std::pair<MegaChatHandle, int>> list;
 };
 
 class MegaChatRoomPrivate : public MegaChatRoom
@@ -782,10 +841,28 @@ public:
     static char *lastnameFromBuffer(const std::string &buffer);
 };
 
+/**
+ * @brief Immutable copy of the chat list, read without locking by app threads.
+ * Entries are sorted by chatid and shared with the next snapshot unless their
+ * chatroom has changed in between.
+ */
+struct ChatListSnapshot
+{
+    struct Entry
+    {
+        MegaChatHandle chatid;
+        std::shared_ptr<MegaChatRoomPrivate> room;
+        std::shared_ptr<MegaChatListItemPrivate> item;
+    };
+    std::vector<Entry> entries;
+};
+
 class MegaChatRoomListPrivate :  public MegaChatRoomList
 {
 public:
     MegaChatRoomListPrivate();
+    // rooms added to the list are owned by the snapshot, which is kept alive by the list
+    MegaChatRoomListPrivate(std::shared_ptr<const ChatListSnapshot> snapshot);
     virtual ~MegaChatRoomListPrivate() {}
     virtual MegaChatRoomList *copy() const;
 
@@ -797,6 +874,7 @@ public:
 private:
     MegaChatRoomListPrivate(const MegaChatRoomListPrivate *list);
     std::vector<MegaChatRoom*> list;
+    std::shared_ptr<const ChatListSnapshot> mSnapshot;
 };
 
 class MegaChatAttachedUser;
@@ -892,17 +970,36 @@ class ChatRequestQueue
         void removeListener(MegaChatRequestListener *listener);
 };
 
-//Thread safe transfer queue
+/** Thread safe queue of marshalled calls: a bounded lock-free ring that supports multiple
+ * producers and a single consumer (the thread of MegaChatApiImpl). When the ring is full,
+ * events go to an overflow list protected by a mutex, and keep going there until the consumer
+ * drains it, so the events posted by each thread are never dropped nor reordered.
+ */
 class EventQueue
 {
 protected:
-    std::deque<void *> events;
-    std::mutex mutex;
+    enum { kCapacity = 4096 };   // must be a power of 2
+
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        void *event;
+    };
+
+    Slot *mSlots;
+    std::atomic<size_t> mEnqueuePos;
+    std::atomic<size_t> mDequeuePos;    // only written by the consumer
+    std::atomic<bool> mOverflowing;
+    std::deque<void *> mOverflow;
+    std::mutex mOverflowMutex;
+
+    void* popFromRing();
 
 public:
+    EventQueue();
+    ~EventQueue();
     void push(void* event);
-    void push_front(void *event);
-    void* pop();
+    void* pop();    // must be called only from the consumer thread
     bool isEmpty();
     size_t size();
 };
@@ -951,10 +1048,23 @@ private:
     int reqtag;
     std::map<int, MegaChatRequestPrivate *> requestMap;
 
+    // period to coalesce online status changes of other users (0: disabled)
+    unsigned int mOnlineStatusCoalescing = 0;
+
+    // whether chats resumed from cache defer loading their history and keys until used
+    bool mLazyChatInit = false;
+
+    // messages kept in RAM per chat and across all chats (0: no limit)
+    unsigned int mHistoryResidentWindow = chatd::Client::kDefaultHistoryResidentWindow;
+    unsigned int mHistoryResidentCap = 0;
+
 #ifndef KARERE_DISABLE_WEBRTC
     std::set<MegaChatCallListener *> callListeners;
     std::map<MegaChatHandle, MegaChatPeerVideoListener_map> videoListeners;
 
+    // frames kept by listeners until releaseVideoBuffer(), with the number of pending releases
+    std::map<char *, std::pair<MegaChatVideoFrame *, int>> retainedVideoFrames;
+
     mega::MegaStringList *getChatInDevices(const std::set<std::string> &devices);
     void cleanCallHandlerMap();
 #endif
@@ -963,6 +1073,16 @@ private:
 
     static int convertInitState(int state);
 
+    // latest snapshot of the chat list (null if outdated). Access only through std::atomic_load/store
+    std::shared_ptr<const ChatListSnapshot> mChatListSnapshot;
+    // last snapshot built, whose entries are reused for unchanged chats (protected by sdkMutex)
+    std::shared_ptr<const ChatListSnapshot> mLastChatListSnapshot;
+    // chats changed since the last snapshot was built (protected by sdkMutex)
+    std::set<MegaChatHandle> mChangedChatListEntries;
+    // returns the current snapshot, building it if outdated (null if there's no chat engine)
+    std::shared_ptr<const ChatListSnapshot> chatListSnapshot();
+    void resetChatListSnapshot();
+
 public:
     static void megaApiPostMessage(void* msg, void* ctx);
     void postMessage(void *msg);
@@ -974,6 +1094,7 @@ public:
     static void setLoggerClass(MegaChatLogger *megaLogger);
     static void setLogWithColors(bool useColors);
     static void setLogToConsole(bool enable);
+    static void setLogAsync(bool enable);
 
     int init(const char *sid, bool waitForFetchnodesToConnect = true);
     int initAnonymous();
@@ -983,6 +1104,9 @@ public:
 
     void importMessages(const char *externalDbPath, MegaChatRequestListener *listener);
 
+    // discards the current snapshot of the chat list, the next one will recreate the entries of the chat
+    void invalidateChatListSnapshot(MegaChatHandle chatid);
+
     MegaChatRoomHandler* getChatRoomHandler(MegaChatHandle chatid);
     void removeChatRoomHandler(MegaChatHandle chatid);
 
@@ -1023,6 +1147,7 @@ public:
     void removeChatCallListener(MegaChatCallListener *listener);
     void addChatVideoListener(MegaChatHandle chatid, MegaChatHandle peerid, MegaChatHandle clientid, MegaChatVideoListener *listener);
     void removeChatVideoListener(MegaChatHandle chatid, MegaChatHandle peerid, MegaChatHandle clientid, MegaChatVideoListener *listener);
+    void releaseVideoBuffer(char *buffer);
 #endif
 
     // MegaChatRequestListener callbacks
@@ -1037,13 +1162,18 @@ public:
     void fireOnChatSessionUpdate(MegaChatHandle chatid, MegaChatHandle callid, MegaChatSessionPrivate *session);
 
     // MegaChatVideoListener callbacks
-    void fireOnChatVideoData(MegaChatHandle chatid, MegaChatHandle peerid, uint32_t clientid, int width, int height, char*buffer);
+    void fireOnChatVideoData(MegaChatHandle chatid, MegaChatHandle peerid, uint32_t clientid, MegaChatVideoFrame *frame);
+    void fireOnChatVideoI420Data(MegaChatHandle chatid, MegaChatHandle peerid, uint32_t clientid, const rtcModule::IVideoRenderer::I420Frame &frame);
+
+    // returns the formats wanted by the video listeners of a peer, as rtcModule::IVideoRenderer formats
+    int getVideoFormats(MegaChatHandle chatid, MegaChatHandle peerid, uint32_t clientid);
 #endif
 
     // MegaChatListener callbacks (specific ones)
     void fireOnChatListItemUpdate(MegaChatListItem *item);
     void fireOnChatInitStateUpdate(int newState);
     void fireOnChatOnlineStatusUpdate(MegaChatHandle userhandle, int status, bool inProgress);
+    void fireOnChatOnlineStatusesUpdate(MegaChatOnlineStatusList *statuses);
     void fireOnChatPresenceConfigUpdate(MegaChatPresenceConfig *config);
     void fireOnChatPresenceLastGreenUpdated(MegaChatHandle userhandle, int lastGreen);
     void fireOnChatConnectionStateUpdate(MegaChatHandle chatid, int newState);
@@ -1066,6 +1196,9 @@ public:
     void localLogout(MegaChatRequestListener *listener = NULL);
 
     void setOnlineStatus(int status, MegaChatRequestListener *listener = NULL);
+    void setOnlineStatusCoalescing(unsigned int periodMs);
+    void setLazyChatInit(bool enable);
+    void setHistoryResidentLimits(unsigned int perChat, unsigned int total);
     int getOnlineStatus();
     bool isOnlineStatusPending();
 
@@ -1192,6 +1325,7 @@ public:
     virtual IApp::IChatHandler *createChatHandler(karere::ChatRoom &chat);
     virtual IApp::IChatListHandler *chatListHandler();
     virtual void onPresenceChanged(karere::Id userid, karere::Presence pres, bool inProgress);
+    virtual void onPresencesChanged(const std::map<karere::Id, karere::Presence>& changes);
     virtual void onPresenceConfigChanged(const presenced::Config& state, bool pending);
     virtual void onPresenceLastGreenUpdated(karere::Id userid, uint16_t lastGreen);
 #ifndef KARERE_DISABLE_WEBRTC
@@ -3,6 +3,7 @@
 
 #include <mega/http.h>
 #include <assert.h>
+#include <karereCommon.h>
 
 using namespace std;
 
@@ -56,6 +57,16 @@ void LibwebsocketsIO::addevents(::mega::Waiter* waiter, int)
 
 }
 
+void LibwebsocketsIO::setMaxFrameSize(size_t size)
+{
+    mMaxFrameSize = size;
+}
+
+size_t LibwebsocketsIO::maxFrameSize() const
+{
+    return mMaxFrameSize;
+}
+
 static void onDnsResolved(uv_getaddrinfo_t *req, int status, struct addrinfo *res)
 {
     vector<string> ipsv4, ipsv6;
@@ -113,7 +124,7 @@ bool LibwebsocketsIO::wsResolveDNS(const char *hostname, std::function<void (int
 
 WebsocketsClientImpl *LibwebsocketsIO::wsConnect(const char *ip, const char *host, int port, const char *path, bool ssl, WebsocketsClient *client)
 {
-    LibwebsocketsClient *libwebsocketsClient = new LibwebsocketsClient(mutex, client);
+    LibwebsocketsClient *libwebsocketsClient = new LibwebsocketsClient(mutex, client, mMaxFrameSize);
     
     std::string cip = ip;
     if (cip[0] == '[')
@@ -149,7 +160,8 @@ int LibwebsocketsIO::wsGetNoNameErrorCode()
     return UV__EAI_NONAME;
 }
 
-LibwebsocketsClient::LibwebsocketsClient(WebsocketsIO::Mutex &mutex, WebsocketsClient *client) : WebsocketsClientImpl(mutex, client)
+LibwebsocketsClient::LibwebsocketsClient(WebsocketsIO::Mutex &mutex, WebsocketsClient *client, size_t maxFrameSize)
+    : WebsocketsClientImpl(mutex, client), mMaxFrameSize(maxFrameSize)
 {
     wsi = NULL;
 }
@@ -161,11 +173,17 @@ LibwebsocketsClient::~LibwebsocketsClient()
 
 void LibwebsocketsClient::appendMessageFragment(char *data, size_t len, size_t remaining)
 {
-    if (!recbuffer.size() && remaining)
+    if (!recbuffer.size())
     {
-        recbuffer.reserve(len + remaining);
+        mRecvStats.lastFrameCopiedBytes = 0;
+        if (remaining)
+        {
+            recbuffer.reserve(len + remaining);
+        }
     }
     recbuffer.append(data, len);
+    mRecvStats.copiedBytes += len;
+    mRecvStats.lastFrameCopiedBytes += len;
 }
 
 bool LibwebsocketsClient::hasFragments()
@@ -185,7 +203,23 @@ size_t LibwebsocketsClient::getMessageLength()
 
 void LibwebsocketsClient::resetMessage()
 {
-    recbuffer.clear();
+    recbuffer.clear();  // keeps the capacity for the next fragmented frame
+    if (recbuffer.capacity() > kMaxRecvBufferCapacity)
+    {
+        // release the memory taken by an unusually big frame
+        std::string().swap(recbuffer);
+    }
+}
+
+void LibwebsocketsClient::dispatchMessage(char *data, size_t len)
+{
+    mRecvStats.frames++;
+    mRecvStats.bytes += len;
+    if (mRecvStats.lastFrameCopiedBytes)
+    {
+        mRecvStats.fragmentedFrames++;
+    }
+    wsHandleMsgCb(data, len);
 }
 
 bool LibwebsocketsClient::wsSendMessage(char *msg, size_t len)
@@ -199,12 +233,16 @@ bool LibwebsocketsClient::wsSendMessage(char *msg, size_t len)
         return false;
     }
     
-    if (!sendbuffer.size())
+    // coalesce with the last pending frame if it fits, otherwise start a new one
+    SendChunk *chunk = mSendQueue.empty() ? nullptr : mSendQueue.back().get();
+    if (!chunk || chunk->payloadSize() + len > mMaxFrameSize)
     {
-        sendbuffer.reserve(LWS_PRE + len);
-        sendbuffer.resize(LWS_PRE);
+        mSendQueue.push_back(allocChunk());
+        chunk = mSendQueue.back().get();
+        chunk->queuedTs = karere::timestampMs();
     }
-    sendbuffer.append(msg, len);
+    chunk->buf.append(msg, len);
+    mSendStats.queuedBytes += len;
 
     if (lws_callback_on_writable(wsi) <= 0)
     {
@@ -260,19 +298,79 @@ bool LibwebsocketsClient::wsIsConnected()
     return wsi != NULL;
 }
 
-const char *LibwebsocketsClient::getOutputBuffer()
+std::unique_ptr<LibwebsocketsClient::SendChunk> LibwebsocketsClient::allocChunk()
 {
-    return sendbuffer.size() ? sendbuffer.data() + LWS_PRE : NULL;
+    std::unique_ptr<SendChunk> chunk;
+    if (mChunkPool.empty())
+    {
+        chunk.reset(new SendChunk);
+        chunk->buf.reserve(LWS_PRE + mMaxFrameSize);
+        chunk->buf.resize(LWS_PRE);
+    }
+    else
+    {
+        chunk = std::move(mChunkPool.back());
+        mChunkPool.pop_back();
+    }
+    return chunk;
 }
 
-size_t LibwebsocketsClient::getOutputBufferLength()
+void LibwebsocketsClient::releaseChunk(std::unique_ptr<SendChunk> chunk)
 {
-    return sendbuffer.size() ? sendbuffer.size() - LWS_PRE : 0;
+    // don't keep chunks that grew beyond the frame size due to a single big message
+    if (mChunkPool.size() >= kMaxPooledChunks || chunk->buf.capacity() > LWS_PRE + mMaxFrameSize)
+    {
+        return;
+    }
+    chunk->buf.resize(LWS_PRE);
+    chunk->queuedTs = 0;
+    mChunkPool.push_back(std::move(chunk));
 }
 
-void LibwebsocketsClient::resetOutputBuffer()
+bool LibwebsocketsClient::writeNextChunk()
 {
-    sendbuffer.clear();
+    if (mSendQueue.empty())
+    {
+        return true;
+    }
+
+    if (lws_partial_buffered(wsi))
+    {
+        // the previous frame has not been fully sent yet, wait for the socket to drain
+        lws_callback_on_writable(wsi);
+        return true;
+    }
+
+    std::unique_ptr<SendChunk> chunk = std::move(mSendQueue.front());
+    mSendQueue.pop_front();
+
+    size_t len = chunk->payloadSize();
+    unsigned char *data = (unsigned char *)&chunk->buf[LWS_PRE];
+    mSendStats.queuedBytes -= len;
+    if (lws_write(wsi, data, len, LWS_WRITE_BINARY) < 0)
+    {
+        WEBSOCKETS_LOG_ERROR("lws_write() failed to send %zu bytes", len);
+        return false;
+    }
+
+    int64_t latency = karere::timestampMs() - chunk->queuedTs;
+    mSendStats.sentBytes += len;
+    mSendStats.sentFrames++;
+    mSendStats.totalFlushLatencyMs += latency;
+    if (latency > mSendStats.maxFlushLatencyMs)
+    {
+        mSendStats.maxFlushLatencyMs = latency;
+    }
+
+    wsSendMsgCb((const char *)data, len);
+    releaseChunk(std::move(chunk));
+
+    // one write per writeable callback: request another one for the remaining frames
+    if (wsi && !mSendQueue.empty())
+    {
+        lws_callback_on_writable(wsi);
+    }
+    return true;
 }
 
 #if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined (LIBRESSL_VERSION_NUMBER) || defined (OPENSSL_IS_BORINGSSL)
@@ -421,8 +519,13 @@ int LibwebsocketsClient::wsCallback(struct lws *wsi, enum lws_callback_reasons r
                     data = (void *)client->getMessage();
                     len = client->getMessageLength();
                 }
+                else
+                {
+                    // single-fragment frames are dispatched straight from the libwebsockets buffer
+                    client->mRecvStats.lastFrameCopiedBytes = 0;
+                }
                 
-                client->wsHandleMsgCb((char *)data, len);
+                client->dispatchMessage((char *)data, len);
                 client->resetMessage();
             }
             else
@@ -447,13 +550,9 @@ int LibwebsocketsClient::wsCallback(struct lws *wsi, enum lws_callback_reasons r
                 return -1;
             }
             
-            data = (void *)client->getOutputBuffer();
-            len = client->getOutputBufferLength();
-            if (len && data)
+            if (!client->writeNextChunk())
             {
-                lws_write(wsi, (unsigned char *)data, len, LWS_WRITE_BINARY);
-                client->wsSendMsgCb((const char *)data, len);
-                client->resetOutputBuffer();
+                return -1;
             }
             break;
         }
@@ -5,6 +5,8 @@
 #include <openssl/ssl.h>
 #include <iostream>
 #include <functional>
+#include <deque>
+#include <memory>
 
 #include "net/websocketsIO.h"
 
@@ -15,12 +17,21 @@ public:
     struct lws_context *wscontext;
     uv_loop_t* eventloop;
 
+    // default max size of the payload of outgoing frames
+    static const size_t kDefaultMaxFrameSize = 64 * 1024;
+
     LibwebsocketsIO(Mutex &mutex, ::mega::Waiter* waiter, ::mega::MegaApi *api, void *ctx);
     virtual ~LibwebsocketsIO();
     
     virtual void addevents(::mega::Waiter*, int);
+
+    // Outgoing messages are coalesced into frames up to this size (applies to new connections)
+    void setMaxFrameSize(size_t size);
+    size_t maxFrameSize() const;
     
 protected:
+    size_t mMaxFrameSize = kDefaultMaxFrameSize;
+
     virtual bool wsResolveDNS(const char *hostname, std::function<void(int, const std::vector<std::string>&, const std::vector<std::string>&)> f);
     virtual WebsocketsClientImpl *wsConnect(const char *ip, const char *host,
                                            int port, const char *path, bool ssl,
@@ -31,21 +42,60 @@ protected:
 class LibwebsocketsClient : public WebsocketsClientImpl
 {
 public:
-    LibwebsocketsClient(WebsocketsIO::Mutex &mutex, WebsocketsClient *client);
+    struct SendStats
+    {
+        size_t queuedBytes = 0;         // bytes waiting in the send queue
+        uint64_t sentBytes = 0;
+        uint64_t sentFrames = 0;
+        int64_t totalFlushLatencyMs = 0;// sum, for every frame, of the time since its first message was queued until written
+        int64_t maxFlushLatencyMs = 0;
+    };
+
+    struct RecvStats
+    {
+        uint64_t frames = 0;
+        uint64_t fragmentedFrames = 0;  // frames received in more than one fragment
+        uint64_t bytes = 0;
+        uint64_t copiedBytes = 0;       // bytes copied to reassemble fragmented frames
+        size_t lastFrameCopiedBytes = 0;
+    };
+
+    LibwebsocketsClient(WebsocketsIO::Mutex &mutex, WebsocketsClient *client, size_t maxFrameSize = LibwebsocketsIO::kDefaultMaxFrameSize);
     virtual ~LibwebsocketsClient();
+    const SendStats &sendStats() const { return mSendStats; }
+    const RecvStats &recvStats() const { return mRecvStats; }
     
 protected:
-    std::string recbuffer;
-    std::string sendbuffer;
+    // max number of released chunks kept for reuse
+    static const size_t kMaxPooledChunks = 4;
+    // max capacity kept by the reassembly buffer between fragmented frames
+    static const size_t kMaxRecvBufferCapacity = 1024 * 1024;
+
+    // An outgoing frame. The payload is preceeded by the LWS_PRE bytes of headroom required by lws_write()
+    struct SendChunk
+    {
+        std::string buf;
+        int64_t queuedTs = 0;   // when the first message of the frame was queued
+        size_t payloadSize() const { return buf.size() - LWS_PRE; }
+    };
+
+    std::string recbuffer;  // reused to reassemble fragmented frames
+    RecvStats mRecvStats;
+    std::deque<std::unique_ptr<SendChunk>> mSendQueue;
+    std::vector<std::unique_ptr<SendChunk>> mChunkPool;
+    size_t mMaxFrameSize;
+    SendStats mSendStats;
 
     void appendMessageFragment(char *data, size_t len, size_t remaining);
     bool hasFragments();
     const char *getMessage();
     size_t getMessageLength();
     void resetMessage();
-    const char *getOutputBuffer();
-    size_t getOutputBufferLength();
-    void resetOutputBuffer();
+    void dispatchMessage(char *data, size_t len);
+    std::unique_ptr<SendChunk> allocChunk();
+    void releaseChunk(std::unique_ptr<SendChunk> chunk);
+    // writes the oldest pending frame, unless libwebsockets still has unsent data. Returns false on error
+    bool writeNextChunk();
     
     virtual bool wsSendMessage(char *msg, size_t len);
     virtual void wsDisconnect(bool immediate);
@@ -1,4 +1,6 @@
 #include "net/websocketsIO.h"
+#include <base/timers.hpp>
+#include <algorithm>
 
 WebsocketsIO::WebsocketsIO(Mutex &m, ::mega::MegaApi *megaApi, void *ctx)
     : mApi(*megaApi, ctx, false), mutex(m)
@@ -27,7 +29,7 @@ void WebsocketsClientImpl::wsConnectCb()
 {
     WebsocketsIO::MutexGuard lock(this->mutex);
     WEBSOCKETS_LOG_DEBUG("Connection established");
-    client->wsConnectCb();
+    client->wsConnectCbPrivate(this);
 }
 
 void WebsocketsClientImpl::wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len)
@@ -43,7 +45,7 @@ void WebsocketsClientImpl::wsCloseCb(int errcode, int errtype, const char *preas
         WEBSOCKETS_LOG_DEBUG("Connection closed by server");
     }
 
-    client->wsCloseCbPrivate(errcode, errtype, preason, reason_len);
+    client->wsCloseCbPrivate(this, errcode, errtype, preason, reason_len);
 }
 
 void WebsocketsClientImpl::wsHandleMsgCb(char *data, size_t len)
@@ -70,6 +72,7 @@ WebsocketsClient::WebsocketsClient()
 
 WebsocketsClient::~WebsocketsClient()
 {
+    abortConnectAttempts();
     delete ctx;
     ctx = NULL;
 }
@@ -102,9 +105,95 @@ bool WebsocketsClient::wsConnect(WebsocketsIO *websocketIO, const char *ip, cons
     {
         WEBSOCKETS_LOG_WARNING("Immediate error in wsConnect");
     }
+    mConnectedIp = ip;
     return ctx != NULL;
 }
 
+bool WebsocketsClient::wsConnect(WebsocketsIO *websocketIO, const std::vector<std::string> &ips, const char *host, int port, const char *path, bool ssl)
+{
+#if defined(_WIN32) && defined(_MSC_VER)
+    thread_id = std::this_thread::get_id();
+#else
+    thread_id = pthread_self();
+#endif
+
+    assert(!ctx && mAttempts.empty());
+    if (ctx)
+    {
+        WEBSOCKETS_LOG_ERROR("Valid context at connect()");
+        websocketIO->mApi.sdk.sendEvent(99010, "A valid previous context existed upon new wsConnect");
+        delete ctx;
+        ctx = NULL;
+    }
+    abortConnectAttempts();
+
+    mConnectIO = websocketIO;
+    mConnectHost = host;
+    mConnectPath = path;
+    mConnectPort = port;
+    mConnectSsl = ssl;
+    mConnectedIp.clear();
+    mPendingIps.assign(ips.begin(), ips.end());
+    return startConnectAttempt();
+}
+
+bool WebsocketsClient::startConnectAttempt()
+{
+    if (mAttemptTimer)
+    {
+        karere::cancelTimeout(mAttemptTimer, mConnectIO->appCtx);
+        mAttemptTimer = 0;
+    }
+
+    while (mPendingIps.size())
+    {
+        std::string ip = mPendingIps.front();
+        mPendingIps.pop_front();
+
+        WEBSOCKETS_LOG_DEBUG("Connecting to %s (%s)  port %d  path: %s   ssl: %d", mConnectHost.c_str(), ip.c_str(), mConnectPort, mConnectPath.c_str(), mConnectSsl);
+        WebsocketsClientImpl *attempt = mConnectIO->wsConnect(ip.c_str(), mConnectHost.c_str(), mConnectPort,
+                                                              mConnectPath.c_str(), mConnectSsl, this);
+        if (!attempt)
+        {
+            WEBSOCKETS_LOG_WARNING("Immediate error in wsConnect to %s", ip.c_str());
+            continue;
+        }
+
+        mAttempts.push_back({attempt, ip});
+        if (mPendingIps.size())
+        {
+            // don't wait for the current attempts to time out before trying the next IP
+            mAttemptTimer = karere::setTimeout([this]()
+            {
+                mAttemptTimer = 0;
+                if (!startConnectAttempt() && mAttempts.empty())
+                {
+                    wsCloseCb(0, 0, "Websocket error on wsConnect", 28);
+                }
+            }, kConnectAttemptDelay, mConnectIO->appCtx);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void WebsocketsClient::abortConnectAttempts()
+{
+    if (mAttemptTimer)
+    {
+        karere::cancelTimeout(mAttemptTimer, mConnectIO->appCtx);
+        mAttemptTimer = 0;
+    }
+    mPendingIps.clear();
+
+    for (auto &attempt: mAttempts)
+    {
+        delete attempt.ctx; // detaches it from the socket, which is closed later
+    }
+    mAttempts.clear();
+}
+
 int WebsocketsClient::wsGetNoNameErrorCode(WebsocketsIO *websocketIO)
 {
     return websocketIO->wsGetNoNameErrorCode();
@@ -139,7 +228,8 @@ bool WebsocketsClient::wsSendMessage(char *msg, size_t len)
 void WebsocketsClient::wsDisconnect(bool immediate)
 {
     WEBSOCKETS_LOG_DEBUG("Disconnecting. Immediate: %d", immediate);
-    
+
+    abortConnectAttempts();
     if (!ctx)
     {
         return;
@@ -163,7 +253,7 @@ bool WebsocketsClient::wsIsConnected()
 {
     if (!ctx)
     {
-        return false;
+        return !mAttempts.empty();
     }
     
 #if defined(_WIN32) && defined(_MSC_VER)
@@ -175,9 +265,48 @@ bool WebsocketsClient::wsIsConnected()
     return ctx->wsIsConnected();
 }
 
-void WebsocketsClient::wsCloseCbPrivate(int errcode, int errtype, const char *preason, size_t reason_len)
+void WebsocketsClient::wsConnectCbPrivate(WebsocketsClientImpl *impl)
 {
-    if (!ctx)   // immediate disconnect ocurred before the marshall is executed (only applies to libws)
+    if (impl != ctx)
+    {
+        auto it = std::find_if(mAttempts.begin(), mAttempts.end(), [impl](const ConnectAttempt &attempt) { return attempt.ctx == impl; });
+        if (it == mAttempts.end())
+        {
+            assert(false);
+            return;
+        }
+
+        // the first attempt to complete the handshake wins, drop the rest
+        assert(!ctx);
+        ctx = impl;
+        mConnectedIp = it->ip;
+        mAttempts.erase(it);
+        abortConnectAttempts();
+    }
+
+    wsConnectCb();
+}
+
+void WebsocketsClient::wsCloseCbPrivate(WebsocketsClientImpl *impl, int errcode, int errtype, const char *preason, size_t reason_len)
+{
+    auto it = std::find_if(mAttempts.begin(), mAttempts.end(), [impl](const ConnectAttempt &attempt) { return attempt.ctx == impl; });
+    if (it != mAttempts.end())
+    {
+        WEBSOCKETS_LOG_DEBUG("Connection attempt to %s failed", it->ip.c_str());
+        mAttempts.erase(it);
+        delete impl;
+
+        // try the next IP right away, or report the failure once all the attempts have failed
+        if (startConnectAttempt() || !mAttempts.empty())
+        {
+            return;
+        }
+
+        wsCloseCb(errcode, errtype, preason, reason_len);
+        return;
+    }
+
+    if (!ctx || impl != ctx)   // immediate disconnect ocurred before the marshall is executed (only applies to libws)
     {
         return;
     }
@@ -259,7 +388,28 @@ void DNScache::loadFromDb()
         {
             // if the record is for chatd, need to add the protocol version to the URL
             addRecord(shard, url, false);
-            setIp(shard, stmt.stringCol(2), stmt.stringCol(3));
+
+            // IPs are stored comma-separated. Their resolveTs is unknown, so they are expired
+            DNSrecord &record = mRecords[shard];
+            for (int col = 2; col <= 3; col++)
+            {
+                std::vector<std::string> &ips = (col == 2) ? record.ipsv4 : record.ipsv6;
+                std::string value = stmt.stringCol(col);
+                size_t pos = 0;
+                while (pos < value.size())
+                {
+                    size_t end = value.find(',', pos);
+                    if (end == std::string::npos)
+                    {
+                        end = value.size();
+                    }
+                    if (end > pos)
+                    {
+                        ips.push_back(value.substr(pos, end - pos));
+                    }
+                    pos = end + 1;
+                }
+            }
         }
         else
         {
@@ -269,39 +419,89 @@ void DNScache::loadFromDb()
     }
 }
 
-bool DNScache::setIp(int shard, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6)
+void DNScache::saveIps(int shard, const DNSrecord &record)
 {
-    if (!isMatch(shard, ipsv4, ipsv6))
+    std::string ipv4, ipv6;
+    for (const std::string &ip : record.ipsv4)
     {
-        auto it = mRecords.find(shard);
-        assert (it != mRecords.end());
-        it->second.ipv4 = ipsv4.empty() ? "" : ipsv4.front();
-        it->second.ipv6 = ipsv6.empty() ? "" : ipsv6.front();
-        it->second.resolveTs = time(NULL);
-        mDb.query("update dns_cache set ipv4=?, ipv6=? where shard=?", it->second.ipv4, it->second.ipv6, shard);
-        return true;
+        ipv4.append(ipv4.empty() ? "" : ",").append(ip);
     }
-    return false;
+    for (const std::string &ip : record.ipsv6)
+    {
+        ipv6.append(ipv6.empty() ? "" : ",").append(ip);
+    }
+    mDb.query("update dns_cache set ipv4=?, ipv6=? where shard=?", ipv4, ipv6, shard);
 }
 
-bool DNScache::setIp(int shard, std::string ipv4, std::string ipv6)
+bool DNScache::setIp(int shard, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6)
 {
-    if (!isMatch(shard, ipv4, ipv6))
+    auto it = mRecords.find(shard);
+    assert(it != mRecords.end());
+    if (it == mRecords.end())
     {
-        auto it = mRecords.find(shard);
-        assert(it != mRecords.end());
-        it->second.ipv4 = ipv4;
-        it->second.ipv6 = ipv6;
-        it->second.resolveTs = time(NULL);
-        mDb.query("update dns_cache set ipv4=?, ipv6=? where shard=?", ipv4, ipv6, shard);
-        return true;
+        return false;
     }
-    return false;
+
+    DNSrecord &record = it->second;
+    record.resolveTs = time(NULL);
+
+    std::vector<std::string> newIpsv4(ipsv4.begin(), ipsv4.begin() + std::min<size_t>(ipsv4.size(), kMaxIpsPerFamily));
+    std::vector<std::string> newIpsv6(ipsv6.begin(), ipsv6.begin() + std::min<size_t>(ipsv6.size(), kMaxIpsPerFamily));
+    if (newIpsv4 == record.ipsv4 && newIpsv6 == record.ipsv6)
+    {
+        return false;
+    }
+
+    record.ipsv4.swap(newIpsv4);
+    record.ipsv6.swap(newIpsv6);
+
+    // forget the history of the IPs that are gone
+    for (auto itTs = record.connectTs.begin(); itTs != record.connectTs.end();)
+    {
+        const std::string &ip = itTs->first;
+        if (std::find(record.ipsv4.begin(), record.ipsv4.end(), ip) == record.ipsv4.end()
+                && std::find(record.ipsv6.begin(), record.ipsv6.end(), ip) == record.ipsv6.end())
+        {
+            itTs = record.connectTs.erase(itTs);
+        }
+        else
+        {
+            itTs++;
+        }
+    }
+
+    saveIps(shard, record);
+    return true;
 }
 
 bool DNScache::invalidateIps(int shard)
 {
-    return setIp(shard, "", "");
+    auto it = mRecords.find(shard);
+    if (it == mRecords.end() || (it->second.ipsv4.empty() && it->second.ipsv6.empty()))
+    {
+        return false;
+    }
+
+    DNSrecord &record = it->second;
+    record.ipsv4.clear();
+    record.ipsv6.clear();
+    record.connectTs.clear();
+    record.resolveTs = 0;
+    saveIps(shard, record);
+    return true;
+}
+
+void DNScache::rankIps(const DNSrecord &record, std::vector<std::string> &ips)
+{
+    // most recently connected first, the rest in the order provided by the resolver
+    std::stable_sort(ips.begin(), ips.end(), [&record](const std::string &a, const std::string &b)
+    {
+        auto itA = record.connectTs.find(a);
+        auto itB = record.connectTs.find(b);
+        time_t tsA = (itA != record.connectTs.end()) ? itA->second : 0;
+        time_t tsB = (itB != record.connectTs.end()) ? itB->second : 0;
+        return tsA > tsB;
+    });
 }
 
 bool DNScache::getIp(int shard, std::string &ipv4, std::string &ipv6)
@@ -312,26 +512,66 @@ bool DNScache::getIp(int shard, std::string &ipv4, std::string &ipv6)
         return false;
     }
 
-    assert(it->second.mUrl.isValid());
-    ipv4 = it->second.ipv4;
-    ipv6 = it->second.ipv6;
+    const DNSrecord &record = it->second;
+    assert(record.mUrl.isValid());
+
+    std::vector<std::string> ipsv4 = record.ipsv4;
+    std::vector<std::string> ipsv6 = record.ipsv6;
+    rankIps(record, ipsv4);
+    rankIps(record, ipsv6);
+    ipv4 = ipsv4.empty() ? "" : ipsv4.front();
+    ipv6 = ipsv6.empty() ? "" : ipsv6.front();
 
     // If both Ip's are empty there's no cached ip's
     return ipv4.size() || ipv6.size();
 }
 
+std::vector<std::string> DNScache::getIpsByPreference(int shard)
+{
+    std::vector<std::string> ips;
+    auto it = mRecords.find(shard);
+    if (it == mRecords.end())
+    {
+        return ips;
+    }
+
+    const DNSrecord &record = it->second;
+    bool ipv4First = record.connectIpv4Ts > record.connectIpv6Ts;
+    std::vector<std::string> first = ipv4First ? record.ipsv4 : record.ipsv6;
+    std::vector<std::string> second = ipv4First ? record.ipsv6 : record.ipsv4;
+    rankIps(record, first);
+    rankIps(record, second);
+
+    for (size_t i = 0; i < first.size() || i < second.size(); i++)
+    {
+        if (i < first.size())
+        {
+            ips.push_back(first[i]);
+        }
+        if (i < second.size())
+        {
+            ips.push_back(second[i]);
+        }
+    }
+    return ips;
+}
+
 void DNScache::connectDone(int shard, const std::string &ip)
 {
     auto it = mRecords.find(shard);
     if (it != mRecords.end())
     {
-        if (ip == it->second.ipv4)
+        DNSrecord &record = it->second;
+        time_t now = time(NULL);
+        if (std::find(record.ipsv4.begin(), record.ipsv4.end(), ip) != record.ipsv4.end())
         {
-            it->second.connectIpv4Ts = time(NULL);
+            record.connectIpv4Ts = now;
+            record.connectTs[ip] = now;
         }
-        else if (ip == it->second.ipv6)
+        else if (std::find(record.ipsv6.begin(), record.ipsv6.end(), ip) != record.ipsv6.end())
         {
-            it->second.connectIpv6Ts = time(NULL);
+            record.connectIpv6Ts = now;
+            record.connectTs[ip] = now;
         }
     }
 }
@@ -347,32 +587,63 @@ time_t DNScache::age(int shard)
     return 0;
 }
 
-bool DNScache::isMatch(int shard, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6)
+bool DNScache::isExpired(int shard)
 {
-    bool match = false;
     auto it = mRecords.find(shard);
     if (it != mRecords.end())
     {
-        std::string ipv4 = it->second.ipv4;
-        std::string ipv6 = it->second.ipv6;
-
-        match = ( ((ipv4.empty() && ipsv4.empty()) // don't have IPv4, but it wasn't received either
-                   || (std::find(ipsv4.begin(), ipsv4.end(), ipv4) != ipsv4.end())) // IPv4 is contained in `ipsv4`
-                  && ((ipv6.empty() && ipsv6.empty())
-                      || std::find(ipsv6.begin(), ipsv6.end(), ipv6) != ipsv6.end()));
+        return time(NULL) - it->second.resolveTs > kMaxAge;
     }
 
-    return match;
+    return true;
 }
 
-bool DNScache::isMatch(int shard, const std::string &ipv4, const std::string &ipv6)
+std::vector<int> DNScache::getShardsToRefresh(bool force)
 {
-    bool match = false;
+    std::vector<int> shards;
+    time_t now = time(NULL);
+    for (auto &it : mRecords)
+    {
+        DNSrecord &record = it.second;
+        if (!record.mUrl.isValid())
+        {
+            continue;
+        }
+
+        if (force || (isExpired(it.first) && now - record.refreshTs > kRefreshTimeout))
+        {
+            record.refreshTs = now;
+            shards.push_back(it.first);
+        }
+    }
+    return shards;
+}
 
+bool DNScache::isMatch(int shard, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6)
+{
+    bool match = false;
     auto it = mRecords.find(shard);
     if (it != mRecords.end())
     {
-        match = (it->second.ipv4 == ipv4) && (it->second.ipv6 == ipv6);
+        const DNSrecord &record = it->second;
+        auto contained = [](const std::vector<std::string> &cached, const std::vector<std::string> &received)
+        {
+            if (cached.empty())
+            {
+                return received.empty();    // don't have IPs, but they weren't received either
+            }
+
+            for (const std::string &ip : cached)
+            {
+                if (std::find(received.begin(), received.end(), ip) != received.end())
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        match = contained(record.ipsv4, ipsv4) && contained(record.ipsv6, ipsv6);
     }
 
     return match;
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <functional>
 #include <vector>
+#include <deque>
 #include <mega/waiter.h>
 #include <mega/thread.h>
 #include "base/logger.h"
@@ -23,6 +24,14 @@ class WebsocketsClientImpl;
 class DNScache
 {
 public:
+    enum
+    {
+        // getaddrinfo() doesn't provide the TTL of the records, so IPs are considered expired after this time
+        kMaxAge = 600,          // (in seconds)
+        kRefreshTimeout = 30,   // min. time between background refreshes of the same record (in seconds)
+        kMaxIpsPerFamily = 4    // max. number of IPs cached for each family
+    };
+
     // reference to db-layer interface
     SqliteDb &mDb;
 
@@ -32,29 +41,40 @@ public:
     void removeRecord(int shard);
     bool hasRecord(int shard);
     bool isValidUrl(int shard);
-    // the record for the given shard must exist
+    // the record for the given shard must exist. Returns true if the cached IPs have changed
     bool setIp(int shard, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6);
-    // the record for the given shard must exist (to load from DB)
-    bool setIp(int shard, std::string ipv4, std::string ipv6);
+    // returns the best ranked IP of each family
     bool getIp(int shard, std::string &ipv4, std::string &ipv6);
+    // cached IPs in the order to be tried: interleaved by family, starting by the family that connected
+    // last or IPv6 (RFC 8305), and within each family by last successful connection
+    std::vector<std::string> getIpsByPreference(int shard);
     bool invalidateIps(int shard);
     void connectDone(int shard, const std::string &ip);
+    // true if, for each family, any of the cached IPs is still in the resolved ones
     bool isMatch(int shard, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6);
-    bool isMatch(int shard, const std::string &ipv4, const std::string &ipv6);
     time_t age(int shard);
+    // true if the IPs were resolved more than kMaxAge ago (or loaded from DB), so they should be refreshed
+    bool isExpired(int shard);
+    // shards whose IPs need a refresh (all of them if `force`). They aren't returned again for kRefreshTimeout
+    std::vector<int> getShardsToRefresh(bool force);
     const karere::Url &getUrl(int shard);
 
 private:
     struct DNSrecord
     {
         karere::Url mUrl;
-        std::string ipv4;
-        std::string ipv6;
-        time_t resolveTs = 0;       // can be used to invalidate IP addresses by age
-        time_t connectIpv4Ts = 0;   // can be used for heuristics based on last successful connection
-        time_t connectIpv6Ts = 0;   // can be used for heuristics based on last successful connection
+        std::vector<std::string> ipsv4;
+        std::vector<std::string> ipsv6;
+        time_t resolveTs = 0;       // IPs are refreshed after kMaxAge (0 for IPs loaded from DB)
+        time_t refreshTs = 0;       // last time a background refresh was requested
+        time_t connectIpv4Ts = 0;   // last successful connection using IPv4
+        time_t connectIpv6Ts = 0;   // last successful connection using IPv6
+        std::map<std::string, time_t> connectTs;   // last successful connection by IP
     };
 
+    void rankIps(const DNSrecord &record, std::vector<std::string> &ips);
+    void saveIps(int shard, const DNSrecord &record);
+
     // Maps shard to DNSrecord
     std::map<int, DNSrecord> mRecords;
     int mChatdVersion;
@@ -106,6 +126,10 @@ protected:
 
 class WebsocketsClient
 {
+public:
+    // delay before starting the connection to the next IP while the previous one is in progress (RFC 8305)
+    static const unsigned kConnectAttemptDelay = 250;   // (in milliseconds)
+
 private:
     WebsocketsClientImpl *ctx;
 #if defined(_WIN32) && defined(_MSC_VER)
@@ -114,17 +138,48 @@ private:
     pthread_t thread_id;
 #endif
 
+    // connection attempts racing to become `ctx`, see wsConnect() with several IPs
+    struct ConnectAttempt
+    {
+        WebsocketsClientImpl *ctx;
+        std::string ip;
+    };
+    std::vector<ConnectAttempt> mAttempts;
+    std::deque<std::string> mPendingIps;    // IPs not attempted yet
+    WebsocketsIO *mConnectIO = nullptr;
+    std::string mConnectHost;
+    std::string mConnectPath;
+    int mConnectPort = 0;
+    bool mConnectSsl = false;
+    megaHandle mAttemptTimer = 0;
+    std::string mConnectedIp;
+
+    bool startConnectAttempt();
+    void abortConnectAttempts();
+
 public:
     WebsocketsClient();
     virtual ~WebsocketsClient();
     bool wsResolveDNS(WebsocketsIO *websocketIO, const char *hostname, std::function<void(int, const std::vector<std::string>&, const std::vector<std::string>&)> f);
     bool wsConnect(WebsocketsIO *websocketIO, const char *ip,
                    const char *host, int port, const char *path, bool ssl);
+    /**
+     * Connects to the first of \c ips that completes the handshake (Happy Eyeballs, RFC 8305).
+     * Attempts are started in order, every kConnectAttemptDelay ms or as soon as the previous
+     * one fails, and the rest are dropped when one succeeds. Only the result of the race is
+     * notified: wsConnectCb() for the winner, or wsCloseCb() when all the attempts failed.
+     * Returns false if no attempt could be started.
+     */
+    bool wsConnect(WebsocketsIO *websocketIO, const std::vector<std::string> &ips,
+                   const char *host, int port, const char *path, bool ssl);
     int wsGetNoNameErrorCode(WebsocketsIO *websocketIO);
     bool wsSendMessage(char *msg, size_t len);  // returns true on success, false if error
     void wsDisconnect(bool immediate);
     bool wsIsConnected();
-    void wsCloseCbPrivate(int errcode, int errtype, const char *preason, size_t reason_len);
+    // IP of the established connection
+    const std::string &wsConnectedIp() const { return mConnectedIp; }
+    void wsConnectCbPrivate(WebsocketsClientImpl *impl);
+    void wsCloseCbPrivate(WebsocketsClientImpl *impl, int errcode, int errtype, const char *preason, size_t reason_len);
 
     virtual void wsConnectCb() = 0;
     virtual void wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len) = 0;
@@ -133,6 +188,33 @@ public:
 };
 
 
+/*
+ * Partial implementation of the WebsocketsClient, just for the purpose of
+ * resolving the IPs of the hostnames in DNScache (ICE servers, background refresh...).
+ */
+class DnsResolver : public WebsocketsClient
+{
+public:
+    DnsResolver() {}
+    virtual ~DnsResolver() {}
+
+    bool wsConnect(WebsocketsIO *websocketIO, const char *ip,
+                   const char *host, int port, const char *path, bool ssl) = delete;
+    bool wsConnect(WebsocketsIO *websocketIO, const std::vector<std::string> &ips,
+                   const char *host, int port, const char *path, bool ssl) = delete;
+    int wsGetNoNameErrorCode(WebsocketsIO *websocketIO) = delete;
+    bool wsSendMessage(char *msg, size_t len) = delete;  // returns true on success, false if error
+    void wsDisconnect(bool immediate) = delete;
+    bool wsIsConnected() = delete;
+    void wsCloseCbPrivate(WebsocketsClientImpl *impl, int errcode, int errtype, const char *preason, size_t reason_len) = delete;
+
+    void wsConnectCb() override {}
+    void wsCloseCb(int errcode, int errtype, const char *preason, size_t /*preason_len*/) override {}
+    void wsHandleMsgCb(char *data, size_t len) override {}
+    void wsSendMsgCb(const char *, size_t) override {}
+};
+
+
 class WebsocketsClientImpl
 {
 protected:
@@ -1,5 +1,6 @@
 #include "presenced.h"
 #include "chatClient.h"
+#include <algorithm>
 
 using namespace std;
 using namespace promise;
@@ -101,18 +102,32 @@ void Client::pushPeers()
         return;
     }
 
-    size_t numPeers = mContacts.size();
-    size_t totalSize = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) * numPeers;
-
-    Command cmd(OP_SNSETPEERS, totalSize);
-    cmd.append<uint64_t>(mLastScsn.val);
-    cmd.append<uint32_t>(numPeers);
-    for (auto it = mContacts.begin(); it != mContacts.end(); it++)
+    if (mPeersCmd.empty() || mPeersCmdVersion != mContactsVersion)
+    {
+        // the set of peers has changed since the last push, serialize it again
+        size_t numPeers = mContacts.size();
+        size_t totalSize = 1 + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) * numPeers;
+
+        mPeersCmd.clear();
+        mPeersCmd.reserve(totalSize);
+        mPeersCmd.append<uint8_t>(OP_SNSETPEERS);
+        mPeersCmd.append<uint64_t>(mLastScsn.val);
+        mPeersCmd.append<uint32_t>(static_cast<uint32_t>(numPeers));
+        char* pos = mPeersCmd.appendPtr(sizeof(uint64_t) * numPeers);
+        for (auto it = mContacts.begin(); it != mContacts.end(); it++)
+        {
+            memcpy(pos, &it->first, sizeof(uint64_t));
+            pos += sizeof(uint64_t);
+        }
+        mPeersCmdVersion = mContactsVersion;
+    }
+    else
     {
-        cmd.append<uint64_t>(it->first);
+        // only the sequence-number may have changed
+        mPeersCmd.write<uint64_t>(1, mLastScsn.val);
     }
 
-    sendCommand(std::move(cmd));
+    sendCommand(mPeersCmd);
 }
 
 void Client::wsConnectCb()
@@ -148,7 +163,6 @@ void Client::onSocketClose(int errcode, int errtype, const std::string& reason)
 
     assert(oldState != kDisconnected);
 
-    usingipv6 = !usingipv6;
     mTargetIp.clear();
 
     if (oldState >= kConnected)
@@ -490,6 +504,7 @@ Client::reconnect()
                 if (mDnsCache.isMatch(kPresencedShard, ipsv4, ipsv6))
                 {
                     PRESENCED_LOG_DEBUG("DNS resolve matches cached IPs.");
+                    mDnsCache.setIp(kPresencedShard, ipsv4, ipsv6);  // refresh the full set of IPs and their age
                 }
                 else
                 {
@@ -606,6 +621,7 @@ void Client::onUsersUpdate(::mega::MegaApi *api, ::mega::MegaUserList *usersUpda
             {
                 // new contact
                 mContacts[userid] = newVisibility;
+                mContactsVersion++;
                 if (newVisibility == ::mega::MegaUser::VISIBILITY_VISIBLE)
                 {
                     addPeerList.emplace_back(userid);
@@ -621,6 +637,7 @@ void Client::onUsersUpdate(::mega::MegaApi *api, ::mega::MegaUserList *usersUpda
                 {
                     // user cancelled the account
                     mContacts.erase(it);
+                    mContactsVersion++;
                     if (oldVisibility == ::mega::MegaUser::VISIBILITY_VISIBLE)
                     {
                         // Send delPeer only if an active contact cancelled the account
@@ -660,6 +677,7 @@ void Client::onEvent(::mega::MegaApi *api, ::mega::MegaEvent *event)
         // reset current status (for the full reload once logged in already)
         mLastScsn = karere::Id::inval();
         mContacts.clear();
+        mContactsVersion++;
 
         auto wptr = weakHandle();
         marshallCall([wptr, this, contacts, chats, scsn]()
@@ -674,6 +692,7 @@ void Client::onEvent(::mega::MegaApi *api, ::mega::MegaEvent *event)
 
             mLastScsn = scsn;
             mContacts.clear();
+            mContactsVersion++;
 
             // initialize the list of contacts
             for (int i = 0; i < contacts->size(); i++)
@@ -751,56 +770,29 @@ void Client::disconnect()
 
 void Client::doConnect()
 {
-    string ipv4, ipv6;
-    bool cachedIPs = mDnsCache.getIp(kPresencedShard, ipv4, ipv6);
-    assert(cachedIPs);
-    mTargetIp = (usingipv6 && ipv6.size()) ? ipv6 : ipv4;
+    // race the cached IPv4 and IPv6 addresses, the first one to connect wins
+    std::vector<std::string> ips = mDnsCache.getIpsByPreference(kPresencedShard);
+    assert(ips.size());
+    mTargetIp = ips.front();
 
     const karere::Url &url = mDnsCache.getUrl(kPresencedShard);
     assert (url.isValid());
 
     setConnState(kConnecting);
-    PRESENCED_LOG_DEBUG("Connecting to presenced using the IP: %s", mTargetIp.c_str());
+    PRESENCED_LOG_DEBUG("Connecting to presenced using the IPs: %s %s", ips.front().c_str(), (ips.size() > 1) ? ips.back().c_str() : "");
 
-    bool rt = wsConnect(mKarereClient->websocketIO, mTargetIp.c_str(),
-          url.host.c_str(),
-          url.port,
-          url.path.c_str(),
-          url.isSecure);
-
-    if (!rt)    // immediate failure --> try the other IP family (if available)
+    if (!wsConnect(mKarereClient->websocketIO, ips,
+              url.host.c_str(),
+              url.port,
+              url.path.c_str(),
+              url.isSecure))
     {
         PRESENCED_LOG_DEBUG("Connection to presenced failed using the IP: %s", mTargetIp.c_str());
-
-        string oldTargetIp = mTargetIp;
-        mTargetIp.clear();
-        if (oldTargetIp == ipv6 && ipv4.size())
-        {
-            mTargetIp = ipv4;
-        }
-        else if (oldTargetIp == ipv4 && ipv6.size())
-        {
-            mTargetIp = ipv6;
-        }
-
-        if (mTargetIp.size())
-        {
-            PRESENCED_LOG_DEBUG("Retrying using the IP: %s", mTargetIp.c_str());
-            if (wsConnect(mKarereClient->websocketIO, mTargetIp.c_str(),
-                          url.host.c_str(),
-                          url.port,
-                          url.path.c_str(),
-                          url.isSecure))
-            {
-                return;
-            }
-            PRESENCED_LOG_DEBUG("Connection to presenced failed using the IP: %s", mTargetIp.c_str());
-        }        
-        else
+        if (ips.size() == 1)
         {
             // do not close the socket, which forces a new retry attempt and turns the DNS response obsolete
             // Instead, let the DNS request to complete, in order to refresh IPs
-            PRESENCED_LOG_DEBUG("Empty cached IP. Waiting for DNS resolution...");
+            PRESENCED_LOG_DEBUG("No other cached IP. Waiting for DNS resolution...");
             return;
         }
 
@@ -912,6 +904,23 @@ void Client::logSend(const Command& cmd)
     krLoggerLog(krLogChannel_presenced, krLogLevelDebug, "send %s\n", buf);
 }
 
+void Command::appendPeersToString(std::string& str, uint32_t numPeers) const
+{
+    // the log line is truncated anyway, don't format the whole list of a large SETPEERS
+    uint32_t numLogged = std::min<uint32_t>(numPeers, kMaxLoggedPeers);
+    for (unsigned int i = 0; i < numLogged; i++)
+    {
+        Id peerId = read<uint64_t>(13+i*8);
+        str.append(ID_CSTR(peerId));
+        if (i + 1 < numPeers)
+            str.append(", ");
+    }
+    if (numLogged < numPeers)
+    {
+        str.append("...");
+    }
+}
+
 //only for sent commands
 void Command::toString(char* buf, size_t bufsize) const
 {
@@ -950,13 +959,7 @@ void Command::toString(char* buf, size_t bufsize) const
             tmpString.append(" num_peers: ");
             tmpString.append(to_string(numPeers));
             tmpString.append((numPeers == 1) ? " peer: " :  " peers: ");
-            for (unsigned int i = 0; i < numPeers; i++)
-            {
-                Id peerId = read<uint64_t>(13+i*8);
-                tmpString.append(ID_CSTR(peerId));
-                if (i + 1 < numPeers)
-                    tmpString.append(", ");
-            }
+            appendPeersToString(tmpString, numPeers);
             snprintf(buf, bufsize, "%s", tmpString.c_str());
             break;
         }
@@ -970,13 +973,7 @@ void Command::toString(char* buf, size_t bufsize) const
             tmpString.append(" num_peers: ");
             tmpString.append(to_string(numPeers));
             tmpString.append((numPeers == 1) ? " peer: " :  " peers: ");
-            for (unsigned int i = 0; i < numPeers; i++)
-            {
-                Id peerId = read<uint64_t>(13+i*8);
-                tmpString.append(ID_CSTR(peerId));
-                if (i + 1 < numPeers)
-                    tmpString.append(", ");
-            }
+            appendPeersToString(tmpString, numPeers);
             snprintf(buf, bufsize, "%s", tmpString.c_str());
             break;
         }
@@ -1008,13 +1005,7 @@ void Command::toString(char* buf, size_t bufsize) const
             {
                 tmpString.append((numPeers == 1) ? " peer: " :  " peers: ");
             }
-            for (unsigned int i = 0; i < numPeers; i++)
-            {
-                Id peerId = read<uint64_t>(13+i*8);
-                tmpString.append(ID_CSTR(peerId));
-                if (i + 1 < numPeers)
-                    tmpString.append(", ");
-            }
+            appendPeersToString(tmpString, numPeers);
             snprintf(buf, bufsize, "%s", tmpString.c_str());
             break;
         }
@@ -1108,6 +1099,12 @@ Client::~Client()
 {
     mApi->sdk.removeGlobalListener(this);
 
+    if (mPresenceCoalesceTimer)
+    {
+        cancelTimeout(mPresenceCoalesceTimer, mKarereClient->appCtx);
+        mPresenceCoalesceTimer = 0;
+    }
+
     disconnect();
     CALL_LISTENER(onDestroy); //we don't delete because it may have its own idea of its lifetime (i.e. it could be a GUI class)
 }
@@ -1304,6 +1301,7 @@ void Client::setConnState(ConnState newState)
     }
     else if (mConnState == kConnected)
     {
+        mTargetIp = wsConnectedIp();  // the IP that won the connection race
         PRESENCED_LOG_DEBUG("Presenced connected to %s", mTargetIp.c_str());
 
         mDnsCache.connectDone(kPresencedShard, mTargetIp);
@@ -1331,7 +1329,7 @@ void Client::addPeers(const std::vector<karere::Id> &peers)
 
     assert(mLastScsn.isValid());
     size_t totalSize = sizeof(uint64_t) + sizeof(uint32_t) + (peers.size() * sizeof(uint64_t));
-    Command cmd(OP_SNADDPEERS, static_cast<uint8_t>(totalSize));
+    Command cmd(OP_SNADDPEERS, totalSize);
     cmd.append<uint64_t>(mLastScsn.val);
     cmd.append<uint32_t>(static_cast<uint32_t>(peers.size()));
     for (size_t i = 0; i < peers.size(); i++)
@@ -1356,7 +1354,7 @@ void Client::removePeers(const std::vector<karere::Id> &peers)
 
     assert(mLastScsn.isValid());
     size_t totalSize = sizeof(uint64_t) + sizeof(uint32_t) + (peers.size() * sizeof(uint64_t));
-    Command cmd(OP_SNDELPEERS, static_cast<uint8_t>(totalSize));
+    Command cmd(OP_SNDELPEERS, totalSize);
     cmd.append<uint64_t>(mLastScsn.val);
     cmd.append<uint32_t>(static_cast<uint32_t>(peers.size()));
     for (size_t i = 0; i < peers.size(); i++)
@@ -1382,10 +1380,47 @@ void Client::updatePeerPresence(karere::Id peer, karere::Presence pres)
             || (contact && !exContact)
             || (exContact && pres.status() == Presence::kUnknown))
     {
-        CALL_LISTENER(onPresenceChange, peer, pres);
+        if (!mPresenceCoalesceWindow || peer == mKarereClient->myHandle())
+        {
+            mPendingPresence.erase(peer);   // coalescing was disabled, don't notify an outdated presence later
+            CALL_LISTENER(onPresenceChange, peer, pres);
+            return;
+        }
+
+        mPendingPresence[peer] = pres;
+        if (!mPresenceCoalesceTimer)
+        {
+            auto wptr = weakHandle();
+            mPresenceCoalesceTimer = setTimeout([this, wptr]()
+            {
+                if (wptr.deleted())
+                    return;
+
+                mPresenceCoalesceTimer = 0;
+                flushPresenceChanges();
+
+            }, mPresenceCoalesceWindow, mKarereClient->appCtx);
+        }
     }
 }
 
+void Client::flushPresenceChanges()
+{
+    if (mPendingPresence.empty())
+        return;
+
+    std::map<karere::Id, karere::Presence> changes;
+    changes.swap(mPendingPresence);
+    PRESENCED_LOG_DEBUG("Notifying %zu coalesced presence changes", changes.size());
+    CALL_LISTENER(onPresenceChanges, changes);
+}
+
+void Client::setPresenceCoalescing(unsigned int windowMs)
+{
+    // changes pending to be notified are flushed by the running timer, if any
+    mPresenceCoalesceWindow = windowMs;
+}
+
 karere::Presence Client::peerPresence(karere::Id peer) const
 {
     auto it = mPeersPresence.find(peer);
@@ -284,7 +284,7 @@ private:
 public:
     Command(): Buffer(){}
     Command(Command&& other): Buffer(std::forward<Buffer>(other)) {assert(!other.buf() && !other.bufSize() && !other.dataSize());}
-    Command(uint8_t opcode, uint8_t reserve=10): Buffer(reserve+1) { write(0, opcode); }
+    Command(uint8_t opcode, size_t reserve=10): Buffer(reserve+1) { write(0, opcode); }
     template<class T>
     Command&& operator+(const T& val)
     {
@@ -300,6 +300,12 @@ public:
     const char* opcodeName() const { return opcodeToStr(opcode()); }
     void toString(char* buf, size_t bufsize) const;
     static inline const char* opcodeToStr(uint8_t code);
+
+protected:
+    enum { kMaxLoggedPeers = 32 };
+    void appendPeersToString(std::string& str, uint32_t numPeers) const;
+
+public:
     virtual ~Command(){}
 };
 
@@ -340,12 +346,9 @@ protected:
     /** When enabled, hearbeat() method is called periodically */
     bool mHeartbeatEnabled = false;
 
-    /** Target IP address being used for the reconnection in-flight */
+    /** Preferred IP address of the reconnection in-flight, or the connected one */
     std::string mTargetIp;
 
-    /** ip version to try first (both are tried) */
-    bool usingipv6 = false;
-
     /** RetryController that manages the reconnection's attempts */
     std::unique_ptr<karere::rh::IRetryController> mRetryCtrl;
 
@@ -392,6 +395,26 @@ protected:
     /** Sequence-number for the list of peers and contacts above (initialized upon completion of catch-up phase) */
     karere::Id mLastScsn = karere::Id::inval();
 
+    /** Version of the set of userids in mContacts, incremented when a userid is added or removed */
+    uint32_t mContactsVersion = 0;
+
+    /** Last OP_SNSETPEERS sent, reused upon reconnection while mContacts doesn't change */
+    Command mPeersCmd;
+
+    /** Version of mContacts serialized in mPeersCmd */
+    uint32_t mPeersCmdVersion = 0;
+
+    /** Period (in milliseconds) to coalesce peers' presence changes. Zero to notify them immediately */
+    unsigned int mPresenceCoalesceWindow = 0;
+
+    /** Latest presence of the peers changed during the current coalescing window */
+    std::map<karere::Id, karere::Presence> mPendingPresence;
+
+    /** Timer to notify the coalesced presence changes */
+    megaHandle mPresenceCoalesceTimer = 0;
+
+    void flushPresenceChanges();
+
     void setConnState(ConnState newState);
 
     virtual void wsConnectCb();
@@ -477,6 +500,13 @@ public:
     void updatePeerPresence(karere::Id peer, karere::Presence pres);
     karere::Presence peerPresence(karere::Id peer) const;
 
+    /** @brief Sets the period to coalesce the presence changes of peers
+     * If greater than zero, the changes received during that period are notified in a single
+     * call to Listener::onPresenceChanges, with the latest presence of each peer.
+     * @param windowMs Period in milliseconds. Zero to notify every change immediately (default)
+     */
+    void setPresenceCoalescing(unsigned int windowMs);
+
     /** @brief Updates user last green if it's more recent than the current value.*/
     bool updateLastGreen(karere::Id userid, time_t lastGreen);
     time_t getLastGreen(karere::Id userid);
@@ -489,6 +519,14 @@ class Listener
 public:
     virtual void onConnStateChange(Client::ConnState state) = 0;
     virtual void onPresenceChange(karere::Id userid, karere::Presence pres, bool inProgress = false) = 0;
+    /** Called instead of onPresenceChange for peers when presence coalescing is enabled */
+    virtual void onPresenceChanges(const std::map<karere::Id, karere::Presence>& changes)
+    {
+        for (auto& change: changes)
+        {
+            onPresenceChange(change.first, change.second);
+        }
+    }
     virtual void onPresenceConfigChanged(const Config& Config, bool pending) = 0;
     virtual void onPresenceLastGreenUpdated(karere::Id userid) = 0;
     virtual void onDestroy(){}
@@ -1,5 +1,6 @@
 #ifndef IVIDEORENDERER_H
 #define IVIDEORENDERER_H
+#include <stdint.h>
 namespace rtcModule
 {
 /**
@@ -17,6 +18,44 @@ namespace rtcModule
 class IVideoRenderer
 {
 public:
+    /** Pixel formats a renderer can receive frames in, they can be combined */
+    enum
+    {
+        kFormatArgb = 0x01, ///< 32bit ARGB, via \c getImageBuffer() and \c frameComplete()
+        kFormatI420 = 0x02  ///< Planar YUV 4:2:0, via \c onI420Frame()
+    };
+
+    /** The planes of a frame in I420 format. The chroma planes are (width+1)/2 x (height+1)/2 */
+    struct I420Frame
+    {
+        const uint8_t* dataY;
+        const uint8_t* dataU;
+        const uint8_t* dataV;
+        int strideY;
+        int strideU;
+        int strideV;
+        unsigned short width;
+        unsigned short height;
+        int rotation;   ///< Clockwise rotation in degrees (0, 90, 180 or 270) to display the frame with
+    };
+
+    /**
+     * @brief Returns the pixel formats the renderer wants frames in, as a combination
+     * of \c kFormatArgb and \c kFormatI420. Called _by a worker thread_ for every frame.
+     * Frames in ARGB format are converted from I420 and rotated before being
+     * passed to the renderer, while I420 frames are passed as they are decoded.
+     * If it returns zero, the frame is dropped.
+     */
+    virtual int frameFormat() { return kFormatArgb; }
+
+    /**
+     * @brief onI420Frame Called _by a worker thread_ with a frame in I420 format, if
+     * \c frameFormat() includes \c kFormatI420. The planes are not copied if the decoder
+     * provides them in that format, and they are only valid until this call returns.
+     * @param frame The planes of the frame, with their strides, and its rotation
+     */
+    virtual void onI420Frame(const I420Frame& /*frame*/) {}
+
     /**
      * @brief getImageBuffer Called by _a worker thread_ to get a buffer where to write
      * frame image data. The size of the buffer must be width*height*4. The image is
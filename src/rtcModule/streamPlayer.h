@@ -158,12 +158,35 @@ public:
 
         if (mVideoEnable)
         {
-            void* userData = NULL;
-            auto buffer = frame.video_frame_buffer()->ToI420();   // smart ptr type changed
+            int format = mRenderer->frameFormat();
+            if (!format)
+                return;
+
+            auto buffer = frame.video_frame_buffer()->ToI420();   // smart ptr type changed (no copy if it's already I420)
+            if (format & IVideoRenderer::kFormatI420)
+            {
+                // rotation is passed as metadata, so the planes are delivered as decoded
+                IVideoRenderer::I420Frame i420;
+                i420.dataY = buffer->DataY();
+                i420.dataU = buffer->DataU();
+                i420.dataV = buffer->DataV();
+                i420.strideY = buffer->StrideY();
+                i420.strideU = buffer->StrideU();
+                i420.strideV = buffer->StrideV();
+                i420.width = (unsigned short)buffer->width();
+                i420.height = (unsigned short)buffer->height();
+                i420.rotation = frame.rotation();
+                mRenderer->onI420Frame(i420);
+            }
+
+            if (!(format & IVideoRenderer::kFormatArgb))
+                return;
+
             if (frame.rotation() != webrtc::kVideoRotation_0)
             {
                 buffer = webrtc::I420Buffer::Rotate(*buffer, frame.rotation());
             }
+            void* userData = NULL;
             unsigned short width = (unsigned short)buffer->width();
             unsigned short height = (unsigned short)buffer->height();
             void* frameBuf = mRenderer->getImageBuffer(width, height, userData);
@@ -303,30 +303,6 @@ public:
     void changeVideoInDevice();
 };
 
-/*
- * Partial implementation of the WebsocketsClient, just for the purpose of
- * resolving the IPs behind the ICE servers in order to be added to cache.
- */
-class DnsResolver : public WebsocketsClient
-{
-public:
-    DnsResolver() {}
-    virtual ~DnsResolver() {}
-
-    bool wsConnect(WebsocketsIO *websocketIO, const char *ip,
-                   const char *host, int port, const char *path, bool ssl) = delete;
-    int wsGetNoNameErrorCode(WebsocketsIO *websocketIO) = delete;
-    bool wsSendMessage(char *msg, size_t len) = delete;  // returns true on success, false if error
-    void wsDisconnect(bool immediate) = delete;
-    bool wsIsConnected() = delete;
-    void wsCloseCbPrivate(int errcode, int errtype, const char *preason, size_t reason_len) = delete;
-
-    void wsConnectCb() override {}
-    void wsCloseCb(int errcode, int errtype, const char *preason, size_t /*preason_len*/) override {}
-    void wsHandleMsgCb(char *data, size_t len) override {}
-    void wsSendMsgCb(const char *, size_t) override {}
-};
-
 class RtcModule: public IRtcModule, public chatd::IRtcHandler
 {
 public:
@@ -35,6 +35,9 @@
 #endif
 #include <locale>
 #include <karereCommon.h>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
 
 namespace strongvelope
 {
@@ -49,6 +52,201 @@ struct Context
     EcKey edKey;
 };
 
+struct ProtocolHandler::DecryptJob
+{
+    std::shared_ptr<ParsedMessage> parsedMsg;
+    std::shared_ptr<SendKey> sendKey;
+    EcKey edKey;
+
+    // the message the job was prepared for, to detect if it has changed when the result is consumed
+    KeyId keyid = CHATD_KEYID_INVALID;
+    size_t msgSize = 0;
+    size_t sigOffset = 0;
+
+    // results, written by the worker thread before setting 'done'
+    bool signatureOk = false;
+    std::string cleartext;
+    std::string error;
+    std::atomic<bool> done;
+
+    // set in the karere thread if the worker pool was shut down before running the job
+    bool cancelled = false;
+
+    // resolved in the karere thread when the job is done or cancelled
+    Promise<void> pms;
+
+    DecryptJob(): done(false) {}
+
+    /** Whether \c msg is still the message that was parsed, without parsing it again */
+    bool matches(const Message& msg) const
+    {
+        const Buffer& signature = parsedMsg->signature;
+        return msg.userid == parsedMsg->sender && msg.keyid == keyid && msg.dataSize() == msgSize
+                && memcmp(msg.buf() + sigOffset, signature.buf(), signature.dataSize()) == 0;
+    }
+
+    void run(Buffer& scratch)
+    {
+        try
+        {
+            signatureOk = parsedMsg->verifySignature(edKey, *sendKey, scratch);
+            if (signatureOk && !parsedMsg->payload.empty())
+            {
+                cleartext = parsedMsg->decryptPayload(*sendKey);
+            }
+        }
+        catch(std::exception& e)
+        {
+            error = e.what();
+        }
+        done = true;
+    }
+};
+
+struct ProtocolHandler::DecryptBatch: public DecryptWorkerPool::Batch
+{
+    ProtocolHandler& handler;
+    karere::DeleteTrackable::Handle handlerRef;
+    // only the karere thread copies or releases the jobs
+    std::vector<std::shared_ptr<DecryptJob>> jobs;
+    uint64_t elapsedUs = 0;
+    uint64_t setupUs = 0;   // spent in verifyBatch(), before submitting the batch
+    size_t skipped = 0;
+
+    DecryptBatch(ProtocolHandler& aHandler): handler(aHandler), handlerRef(aHandler.weakHandle()) {}
+
+    void run() override
+    {
+        auto start = std::chrono::steady_clock::now();
+        Buffer scratch(256);    // signed content of each message, reused by the whole batch
+        for (auto& job: jobs)
+        {
+            job->run(scratch);
+        }
+        elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+    }
+
+    void complete(bool cancelled) override
+    {
+        if (cancelled)
+        {
+            STRONGVELOPE_LOG_DEBUG("Decrypt workers shut down, a batch of %zu messages will be decrypted by msgDecrypt()", jobs.size());
+        }
+        else if (!handlerRef.deleted())
+        {
+            DecryptBatchStats& stats = handler.mDecryptBatchStats;
+            stats.batches++;
+            stats.messages += jobs.size();
+            stats.totalUs += elapsedUs;
+            stats.totalSetupUs += setupUs;
+            stats.lastBatchUs = elapsedUs;
+            stats.lastBatchSetupUs = setupUs;
+            stats.lastBatchSize = jobs.size();
+            stats.lastBatchSkipped = skipped;
+            if (jobs.size() > 1)
+            {
+                STRONGVELOPE_LOG_DEBUG("Verified a batch of %zu messages in %llu us (setup %llu us, %zu skipped)",
+                                       jobs.size(), (unsigned long long)elapsedUs, (unsigned long long)setupUs, skipped);
+            }
+        }
+
+        for (auto& job: jobs)
+        {
+            job->cancelled = cancelled;
+            job->pms.resolve();
+        }
+    }
+};
+
+struct ProtocolHandler::DecryptKeyCache
+{
+    std::map<UserKeyId, std::shared_ptr<SendKey>> sendKeys;
+    std::map<karere::Id, const Buffer*> edKeys;     // owned by the UserAttrCache
+};
+
+unsigned DecryptWorkerPool::defaultThreadCount()
+{
+    return std::min(4u, std::max(1u, std::thread::hardware_concurrency()) - 1);
+}
+
+DecryptWorkerPool::DecryptWorkerPool(unsigned count, void *appCtx)
+    : mAppCtx(appCtx)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        mThreads.emplace_back([this]() { run(); });
+    }
+}
+
+DecryptWorkerPool::~DecryptWorkerPool()
+{
+    shutdown();
+}
+
+bool DecryptWorkerPool::push(Batch* batch)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mExit || mThreads.empty())
+        {
+            return false;
+        }
+        mBatches.push_back(batch);
+    }
+    mCond.notify_one();
+    return true;
+}
+
+void DecryptWorkerPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mExit)
+        {
+            return;
+        }
+        mExit = true;
+    }
+    mCond.notify_all();
+    for (auto& thread: mThreads)
+    {
+        thread.join();
+    }
+    mThreads.clear();
+    assert(mBatches.empty());
+}
+
+void DecryptWorkerPool::run()
+{
+    while (true)
+    {
+        Batch* batch;
+        bool cancelled;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCond.wait(lock, [this]() { return mExit || !mBatches.empty(); });
+            if (mBatches.empty())
+            {
+                return;
+            }
+            batch = mBatches.front();
+            mBatches.pop_front();
+            cancelled = mExit;  // pending batches are not run after shutdown, just returned
+        }
+
+        if (!cancelled)
+        {
+            batch->run();
+        }
+        karere::marshallCall([batch, cancelled]()
+        {
+            batch->complete(cancelled);
+            delete batch;
+        }, mAppCtx);
+    }
+}
+
 const std::string SVCRYPTO_PAIRWISE_KEY = "strongvelope pairwise key\x01";
 const std::string SVCRYPTO_SIG = "strongvelopesig";
 void deriveNonceSecret(const StaticBuffer& masterNonce, const StaticBuffer &result,
@@ -123,6 +321,13 @@ void ParsedMessage::symmetricDecrypt(const StaticBuffer& key, Message& outMsg)
     }
     Id chatid = mProtoHandler.chatid;   // for the log below
     STRONGVELOPE_LOG_DEBUG("Decrypting msg %s", outMsg.id().toString().c_str());
+    std::string cleartext = decryptPayload(key);
+    parsePayload(StaticBuffer(cleartext, false), outMsg);
+    outMsg.setEncrypted(Message::kNotEncrypted);
+}
+
+std::string ParsedMessage::decryptPayload(const StaticBuffer& key) const
+{
     Key<32> derivedNonce;
     // deriveNonceSecret() needs at least 32 bytes output buffer
     deriveNonceSecret(nonce, derivedNonce);
@@ -130,10 +335,8 @@ void ParsedMessage::symmetricDecrypt(const StaticBuffer& key, Message& outMsg)
     // For AES CRT mode, we take the first 12 bytes as the nonce,
     // and the remaining 4 bytes as the counter, which is initialized to zero
     *reinterpret_cast<uint32_t*>(derivedNonce.buf()+SVCRYPTO_NONCE_SIZE) = 0;
-    std::string cleartext = aesCTRDecrypt(std::string(payload.buf(), payload.dataSize()),
+    return aesCTRDecrypt(std::string(payload.buf(), payload.dataSize()),
         key, derivedNonce);
-    parsePayload(StaticBuffer(cleartext, false), outMsg);
-    outMsg.setEncrypted(Message::kNotEncrypted);
 }
 
 /**
@@ -200,21 +403,28 @@ bool ParsedMessage::verifySignature(const StaticBuffer& pubKey, const SendKey& s
                 messageStr.dataSize(), pubKey.ubuf()) == 0);
     }
 
-    assert(sendKey.dataSize() == SVCRYPTO_KEY_SIZE);
     Buffer messageStr(SVCRYPTO_SIG.size()+sendKey.dataSize()+signedContent.dataSize()+2);
+    return verifySignature(pubKey, sendKey, messageStr);
+}
 
-    messageStr.append(SVCRYPTO_SIG.c_str(), SVCRYPTO_SIG.size())
+bool ParsedMessage::verifySignature(const StaticBuffer& pubKey, const SendKey& sendKey, Buffer& scratch) const
+{
+    assert(pubKey.dataSize() == 32);
+    assert(protocolVersion >= 2);
+    assert(sendKey.dataSize() == SVCRYPTO_KEY_SIZE);
+    scratch.clear();
+    scratch.append(SVCRYPTO_SIG.c_str(), SVCRYPTO_SIG.size())
     .append<uint8_t>(protocolVersion)
     .append<uint8_t>(type)
     .append(sendKey)
     .append(signedContent);
 
 //    STRONGVELOPE_LOG_DEBUG("signature:\n%s", signature.toString().c_str());
-//    STRONGVELOPE_LOG_DEBUG("message:\n%s", messageStr.toString().c_str());
+//    STRONGVELOPE_LOG_DEBUG("message:\n%s", scratch.toString().c_str());
 //    STRONGVELOPE_LOG_DEBUG("pubKey:\n%s", pubKey.toString().c_str());
     // if crypto_sign_verify_detached does not return 0, it means Incorrect signature!
-    return (crypto_sign_verify_detached(signature.ubuf(), messageStr.ubuf(),
-            messageStr.dataSize(), pubKey.ubuf()) == 0);
+    return (crypto_sign_verify_detached(signature.ubuf(), scratch.ubuf(),
+            scratch.dataSize(), pubKey.ubuf()) == 0);
 }
 
 /**
@@ -558,7 +768,6 @@ ProtocolHandler::ProtocolHandler(karere::Id ownHandle,
   mDb(db), chatid(aChatId), mPh(ph)
 {
     getPubKeyFromPrivKey(myPrivEd25519, kKeyTypeEd25519, myPubEd25519);
-    loadKeysFromDb();
     loadUnconfirmedKeysFromDb();
     auto var = getenv("KRCHAT_FORCE_RSA");
     if (var)
@@ -647,8 +856,10 @@ ProtocolHandler::reactionEncrypt(const Message &msg, const std::string &reaction
         symPms = getKey(UserKeyId(msg.userid, msg.keyid));
     }
 
+    // the message may be evicted from RAM before the key is available
+    karere::Id msgid = msg.id();
     auto wptr = weakHandle();
-    return symPms.then([wptr, &msg, &reaction](const std::shared_ptr<SendKey>& data)
+    return symPms.then([wptr, msgid, reaction](const std::shared_ptr<SendKey>& data)
     {
         wptr.throwIfDeleted();
 
@@ -657,7 +868,7 @@ ProtocolHandler::reactionEncrypt(const Message &msg, const std::string &reaction
         std::vector<uint32_t> key32 = ::mega::Utils::str_to_a32<uint32_t>(keyBin);
         size_t key32Len = key32.size();
 
-        std::string msgId(msg.id().toString());
+        std::string msgId(msgid.toString());
         std::vector<uint32_t> msgId32 = ::mega::Utils::str_to_a32<uint32_t>(msgId);
         size_t msgId32Len = msgId32.size();
 
@@ -707,8 +918,10 @@ ProtocolHandler::reactionDecrypt(const Message &msg, const std::string &reaction
         symPms = getKey(UserKeyId(msg.userid, msg.keyid));
     }
 
+    // the message may be evicted from RAM before the key is available
+    karere::Id msgid = msg.id();
     auto wptr = weakHandle();
-    return symPms.then([wptr, &msg, &reaction](const std::shared_ptr<SendKey>& data)
+    return symPms.then([wptr, msgid, reaction](const std::shared_ptr<SendKey>& data)
     {
         wptr.throwIfDeleted();
 
@@ -717,7 +930,7 @@ ProtocolHandler::reactionDecrypt(const Message &msg, const std::string &reaction
         std::vector<uint32_t> key32 = ::mega::Utils::str_to_a32<uint32_t>(keyBin);
         size_t key32Len = key32.size();
 
-        std::string msgId = msg.id().toString();
+        std::string msgId = msgid.toString();
         std::vector<uint32_t> msgId32 =  ::mega::Utils::str_to_a32<uint32_t>(msgId);
         size_t msgId32Len = msgId32.size();
 
@@ -755,6 +968,10 @@ unsigned int ProtocolHandler::getCacheVersion() const
 
 void ProtocolHandler::loadKeysFromDb()
 {
+    if (mKeysLoaded)
+        return;
+
+    mKeysLoaded = true;
     SqliteStmt stmt(mDb, "select userid, keyid, key from sendkeys where chatid=?");
     stmt << chatid;
     while(stmt.step())
@@ -1200,6 +1417,7 @@ Message* ProtocolHandler::legacyMsgDecrypt(const std::shared_ptr<ParsedMessage>&
 void ProtocolHandler::onHistoryReload()
 {
     mCacheVersion++;
+    mDecryptJobs.clear();
 }
 
 promise::Promise<Message*> ProtocolHandler::handleManagementMessage(
@@ -1288,6 +1506,20 @@ Promise<Message*> ProtocolHandler::msgDecrypt(Message* message)
             return Promise<Message*>(message);
         }
 
+        // verification and decryption may have been started in advance by verifyBatch()
+        auto itJob = mDecryptJobs.find(message->id());
+        if (itJob != mDecryptJobs.end())
+        {
+            std::shared_ptr<DecryptJob> job = itJob->second;
+            mDecryptJobs.erase(itJob);
+            if (job->matches(*message))
+            {
+                message->type = job->parsedMsg->type;
+                return finishDecryptJob(job, message);
+            }
+            // the message has changed since the job was started, discard the result
+        }
+
         // Get type
         auto parsedMsg = std::make_shared<ParsedMessage>(*message, *this);
         message->type = parsedMsg->type;
@@ -1380,12 +1612,190 @@ Promise<Message*> ProtocolHandler::msgDecrypt(Message* message)
     }
 }
 
+void ProtocolHandler::verifyBatch(const std::vector<Message*>& messages)
+{
+    auto start = std::chrono::steady_clock::now();
+    DecryptKeyCache keyCache;   // keys of each sender are looked up once per batch
+    DecryptBatch* batch = new DecryptBatch(*this);
+    batch->jobs.reserve(messages.size());
+    for (Message* message: messages)
+    {
+        if (message->empty() || message->userid == karere::Id::COMMANDER()
+                || mDecryptJobs.find(message->id()) != mDecryptJobs.end())
+        {
+            continue;
+        }
+
+        try
+        {
+            auto parsedMsg = std::make_shared<ParsedMessage>(*message, *this);
+            if (parsedMsg->protocolVersion <= 1
+                    || (parsedMsg->type >= Message::kMsgManagementLowest && parsedMsg->type <= Message::kMsgManagementHighest))
+            {
+                continue;
+            }
+
+            std::shared_ptr<DecryptJob> job = prepareDecryptJob(parsedMsg, *message, &keyCache);
+            if (job)
+            {
+                batch->jobs.push_back(std::move(job));
+            }
+            else
+            {
+                batch->skipped++;
+            }
+        }
+        catch(std::runtime_error& e)
+        {
+            // malformed message, it will be reported by msgDecrypt()
+        }
+    }
+
+    if (batch->jobs.empty())
+    {
+        delete batch;
+        return;
+    }
+    batch->setupUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    submitDecryptBatch(batch);
+}
+
+std::shared_ptr<ProtocolHandler::DecryptJob>
+ProtocolHandler::prepareDecryptJob(const std::shared_ptr<ParsedMessage>& parsedMsg, const Message& msg,
+    DecryptKeyCache* keyCache)
+{
+    // only if both keys are available without waiting
+    std::shared_ptr<SendKey> sendKey;
+    UserKeyId ukid(msg.userid, msg.keyid);
+    if (keyCache && keyCache->sendKeys.count(ukid))
+    {
+        sendKey = keyCache->sendKeys[ukid];
+    }
+    else
+    {
+        promise::Promise<std::shared_ptr<SendKey>> symPms = (msg.keyid == CHATD_KEYID_INVALID)
+                ? mUnifiedKeyDecrypted
+                : getKey(ukid);
+        if (symPms.succeeded())
+        {
+            sendKey = symPms.value();
+        }
+        if (keyCache)
+        {
+            keyCache->sendKeys[ukid] = sendKey;
+        }
+    }
+    if (!sendKey)
+    {
+        return nullptr;
+    }
+
+    const Buffer* edKey = nullptr;
+    if (keyCache && keyCache->edKeys.count(parsedMsg->sender))
+    {
+        edKey = keyCache->edKeys[parsedMsg->sender];
+    }
+    else
+    {
+        promise::Promise<Buffer*> edPms = mUserAttrCache.getAttr(parsedMsg->sender,
+            ::mega::MegaApi::USER_ATTR_ED25519_PUBLIC_KEY, mPh);
+        if (edPms.succeeded() && edPms.value() && edPms.value()->dataSize() == EcKey::bufSize())
+        {
+            edKey = edPms.value();
+        }
+        if (keyCache)
+        {
+            keyCache->edKeys[parsedMsg->sender] = edKey;
+        }
+    }
+    if (!edKey)
+    {
+        return nullptr;
+    }
+
+    auto job = std::make_shared<DecryptJob>();
+    job->parsedMsg = parsedMsg;
+    job->sendKey = sendKey;
+    job->edKey.assign(edKey->buf(), edKey->dataSize());
+    job->keyid = msg.keyid;
+    job->msgSize = msg.dataSize();
+    // the signed content follows the signature, up to the end of the message
+    job->sigOffset = msg.dataSize() - parsedMsg->signedContent.dataSize() - parsedMsg->signature.dataSize();
+    mDecryptJobs[msg.id()] = job;
+    return job;
+}
+
+void ProtocolHandler::submitDecryptBatch(DecryptBatch* batch)
+{
+    if (!mDecryptWorkerPool || !mDecryptWorkerPool->push(batch))
+    {
+        batch->run();
+        batch->complete(false);
+        delete batch;
+    }
+}
+
+Promise<Message*>
+ProtocolHandler::finishDecryptJob(const std::shared_ptr<DecryptJob>& job, Message* message)
+{
+    unsigned int cacheVersion = mCacheVersion;
+    auto wptr = weakHandle();
+    auto apply = [this, wptr, job, message, cacheVersion]() -> promise::Promise<Message*>
+    {
+        if (wptr.deleted())
+        {
+            return ::promise::Error("msgDecrypt: strongvelop deleted, ignore message", EINVAL, SVCRYPTO_EEXPIRED);
+        }
+
+        if (cacheVersion != mCacheVersion)
+        {
+            return ::promise::Error("msgDecrypt: history was reloaded, ignore message", EINVAL, SVCRYPTO_ENOMSG);
+        }
+
+        if (job->cancelled)
+        {
+            Buffer scratch(256);
+            job->run(scratch);
+        }
+
+        if (!job->error.empty())
+        {
+            return ::promise::Error(job->error, EINVAL, SVCRYPTO_EMALFORMED);
+        }
+
+        if (!job->signatureOk)
+        {
+            return ::promise::Error("Signature invalid for message "+
+                                  message->id().toString(), EINVAL, SVCRYPTO_ESIGNATURE);
+        }
+
+        if (job->parsedMsg->payload.empty())
+        {
+            message->clear();
+            return message;
+        }
+
+        job->parsedMsg->parsePayload(StaticBuffer(job->cleartext, false), *message);
+        message->setEncrypted(Message::kNotEncrypted);
+        return message;
+    };
+
+    // the worker may have finished before the marshalled notification is processed
+    if (job->done)
+    {
+        return apply();
+    }
+    return job->pms.then(apply);
+}
+
 Promise<void>
 ProtocolHandler::legacyExtractKeys(const std::shared_ptr<ParsedMessage>& parsedMsg)
 {
     if (parsedMsg->encryptedKey.empty())
         return ::promise::Error("legacyExtractKeys: No encrypted keys found in parsed message", EPROTO, SVCRYPTO_ERRTYPE);
 
+    loadKeysFromDb();
     auto& key1 = mKeys[UserKeyId(parsedMsg->sender, parsedMsg->keyId)];
     if (!key1.key)
     {
@@ -1421,6 +1831,7 @@ ProtocolHandler::legacyExtractKeys(const std::shared_ptr<ParsedMessage>& parsedM
 void ProtocolHandler::onKeyReceived(KeyId keyid, Id sender, Id receiver,
                                     const char* data, uint16_t dataLen, bool isEncrypted)
 {
+    loadKeysFromDb();
     UserKeyId ukid(sender, keyid);
     if (!isEncrypted)
     {
@@ -1475,6 +1886,7 @@ void ProtocolHandler::onKeyReceived(KeyId keyid, Id sender, Id receiver,
 
 void ProtocolHandler::addDecryptedKey(UserKeyId ukid, const std::shared_ptr<SendKey>& key)
 {
+    loadKeysFromDb();
     assert(key->dataSize() == SVCRYPTO_KEY_SIZE);
     STRONGVELOPE_LOG_DEBUG("Adding key %lld of user %s", ukid.keyid, ukid.user.toString().c_str());
 
@@ -1511,6 +1923,7 @@ void ProtocolHandler::addDecryptedKey(UserKeyId ukid, const std::shared_ptr<Send
 promise::Promise<std::shared_ptr<SendKey>>
 ProtocolHandler::getKey(UserKeyId ukid, bool legacy)
 {
+    loadKeysFromDb();
     auto kit = mKeys.find(ukid);
     if (kit == mKeys.end())
     {
@@ -1545,6 +1958,7 @@ ProtocolHandler::getKey(UserKeyId ukid, bool legacy)
 
 void ProtocolHandler::onKeyConfirmed(KeyId localkeyid, KeyId keyid)
 {
+    loadKeysFromDb();
     // new keys are always confirmed in the same order than received by chatd
     auto it = mUnconfirmedKeys.begin();
     if (it == mUnconfirmedKeys.end())
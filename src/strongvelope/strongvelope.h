@@ -12,6 +12,10 @@
 #include <string>
 #include <assert.h>
 #include <iostream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <buffer.h>
 #include <karereId.h>
 #include <chatdMsg.h>
@@ -190,9 +194,14 @@ struct ParsedMessage: public karere::DeleteTrackable
 
     ParsedMessage(const chatd::Message& src, ProtocolHandler& protoHandler);
     bool verifySignature(const StaticBuffer& pubKey, const SendKey& sendKey);
+    /** Same as above, but builds the signed content in \c scratch, so the buffer can be
+     * reused when verifying a batch of messages. It doesn't modify the object */
+    bool verifySignature(const StaticBuffer& pubKey, const SendKey& sendKey, Buffer& scratch) const;
     void parsePayload(const StaticBuffer& data, chatd::Message& msg);
     void parsePayloadWithUtfBackrefs(const StaticBuffer& data, chatd::Message& msg);
     void symmetricDecrypt(const StaticBuffer& key, chatd::Message& outMsg);
+    /** Returns the decrypted payload. It doesn't modify the object, so it can be called from any thread */
+    std::string decryptPayload(const StaticBuffer& key) const;
     promise::Promise<chatd::Message*> decryptChatTitle(chatd::Message* msg, bool msgCanBeDeleted);
 };
 
@@ -262,6 +271,48 @@ class TlvWriter;
 extern const std::string SVCRYPTO_PAIRWISE_KEY;
 void deriveSharedKey(const StaticBuffer& sharedSecret, SendKey& output, const std::string& padString=SVCRYPTO_PAIRWISE_KEY);
 
+/**
+ * @brief Fixed-size pool of threads that verify and decrypt batches of messages in FIFO order.
+ *
+ * It's owned by the karere::Client and shared by its chats. Batches are created, completed and
+ * destroyed in the karere thread: workers only run them and marshall them back when done.
+ */
+class DecryptWorkerPool
+{
+public:
+    struct Batch
+    {
+        virtual ~Batch() {}
+        /** Runs in a worker thread */
+        virtual void run() = 0;
+        /** Runs in the karere thread. If \c cancelled, run() was not called */
+        virtual void complete(bool cancelled) = 0;
+    };
+
+    /** Default number of threads: min(4, cores - 1) */
+    static unsigned defaultThreadCount();
+
+    DecryptWorkerPool(unsigned count, void *appCtx);
+    ~DecryptWorkerPool();
+
+    /** Queues the batch, which is deleted after its completion.
+     * Returns false if the pool has no threads or was shut down, so the batch is still owned by the caller */
+    bool push(Batch* batch);
+
+    /** Stops the workers. Pending batches are marshalled back as cancelled */
+    void shutdown();
+
+protected:
+    void *mAppCtx;
+    std::vector<std::thread> mThreads;
+    std::deque<Batch*> mBatches;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    bool mExit = false;
+
+    void run();
+};
+
 /**
  * @brief The ProtocolHandler class implements ICrypto.
  * @see chatd::ICrypto for more details.
@@ -322,6 +373,9 @@ protected:
     // received and confirmed keys (doesn't include unconfirmed keys)
     std::map<UserKeyId, KeyEntry> mKeys;
 
+    // keys are loaded from db on first use, not when the chat is created
+    bool mKeysLoaded = false;
+
     // cache of symmetric keys (pubCu255 * privCu255)
     std::map<karere::Id, std::shared_ptr<SendKey>> mSymmKeyCache;
 
@@ -333,6 +387,34 @@ protected:
     std::shared_ptr<UnifiedKey> mUnifiedKey;
     promise::Promise<std::shared_ptr<UnifiedKey>> mUnifiedKeyDecrypted;
 
+    /** Verification and decryption of a message, run by a worker thread */
+    struct DecryptJob;
+    /** Jobs submitted together to the worker pool */
+    struct DecryptBatch;
+    // decrypt jobs started in advance, not yet consumed by msgDecrypt(), by msgid
+    std::map<karere::Id, std::shared_ptr<DecryptJob>> mDecryptJobs;
+    /** Keys looked up once per batch of messages */
+    struct DecryptKeyCache;
+    // null if messages are decrypted in the karere thread
+    DecryptWorkerPool* mDecryptWorkerPool = nullptr;
+
+public:
+    /** Timing of the batches (usually pages of history) passed to verifyBatch() */
+    struct DecryptBatchStats
+    {
+        uint64_t batches = 0;
+        uint64_t messages = 0;
+        uint64_t totalUs = 0;       // time spent verifying and decrypting, for all batches
+        uint64_t totalSetupUs = 0;  // time spent parsing messages and looking up keys, in the karere thread
+        uint64_t lastBatchUs = 0;
+        uint64_t lastBatchSetupUs = 0;
+        size_t lastBatchSize = 0;
+        size_t lastBatchSkipped = 0; // messages left to msgDecrypt(), i.e. without keys available yet
+    };
+
+protected:
+    DecryptBatchStats mDecryptBatchStats;
+
 public:
     karere::Id chatid;
     karere::Id mPh = karere::Id::inval();     // it's only valid during preview mode (required to fetch user-attributes)
@@ -350,9 +432,10 @@ public:
 
     unsigned int getCacheVersion() const;
 
-protected:
+    /** Loads the send keys of the chat from db into mKeys, if not loaded yet */
     void loadKeysFromDb();
 
+protected:
     /**
      * @brief Load unconfirmed keys stored in cache
      *
@@ -409,6 +492,24 @@ protected:
     chatd::Message* legacyMsgDecrypt(const std::shared_ptr<ParsedMessage>& parsedMsg,
         chatd::Message* msg, const SendKey& key);
 
+    /**
+     * @brief Prepares the verification and decryption of the message, if the required keys
+     * are available without waiting. The job is registered, but it's not submitted to the
+     * workers until \c submitDecryptBatch() is called.
+     * @param keyCache If not null, keys are looked up there first, and added to it
+     * @return The job, or nullptr if the keys are not available
+     */
+    std::shared_ptr<DecryptJob> prepareDecryptJob(const std::shared_ptr<ParsedMessage>& parsedMsg,
+        const chatd::Message& msg, DecryptKeyCache* keyCache = nullptr);
+
+    /** Runs the batch in a worker thread, or in the calling thread if there's no worker
+     * pool or it was shut down */
+    void submitDecryptBatch(DecryptBatch* batch);
+
+    /** Applies the result of the job to the message, once the job is done (in the karere thread) */
+    promise::Promise<chatd::Message*> finishDecryptJob(const std::shared_ptr<DecryptJob>& job,
+        chatd::Message* msg);
+
     void fetchUserKeys(karere::Id userid);
 
 // legacy RSA encryption methods
@@ -429,6 +530,14 @@ public:
     promise::Promise<std::pair<chatd::MsgCommand*, chatd::KeyCommand*>>
     msgEncrypt(chatd::Message *message, const karere::SetOfIds &recipients, chatd::MsgCommand* msgCmd) override;
     promise::Promise<chatd::Message*> msgDecrypt(chatd::Message* message) override;
+    /** Parses the page and looks up its keys once per sender and keyid, then verifies and
+     * decrypts it as a single batch in the worker pool. msgDecrypt() consumes the results,
+     * reusing the parsed messages. Messages whose keys aren't available yet are skipped */
+    void verifyBatch(const std::vector<chatd::Message*>& messages) override;
+    const DecryptBatchStats& decryptBatchStats() const { return mDecryptBatchStats; }
+
+    /** Sets the pool used by verifyBatch(), or null to decrypt in the karere thread. It must outlive this object */
+    void setDecryptWorkerPool(DecryptWorkerPool* pool) { mDecryptWorkerPool = pool; }
     void onKeyReceived(chatd::KeyId keyid, karere::Id sender,
         karere::Id receiver, const char* data, uint16_t dataLen, bool isEncrypted) override;
     void onKeyConfirmed(chatd::KeyId localkeyid, chatd::KeyId keyid) override;
@@ -361,6 +361,11 @@ UserAttrCache::Handle UserAttrCache::getAttr(uint64_t userHandle, unsigned type,
     auto it = find(key);
     if (it != end())
     {
+        if (it->second->pending == kCacheFetchNewPending)
+            mStats.joined++;
+        else
+            mStats.hits++;
+
         if (cb)
         {
             auto& item = *it->second;
@@ -386,6 +391,7 @@ UserAttrCache::Handle UserAttrCache::getAttr(uint64_t userHandle, unsigned type,
     }
 
     //we don't have the attrib item, create it
+    mStats.misses++;
     UACACHE_LOG_DEBUG("Attibute %s not found in cache, fetching", key.toString().c_str());
     auto item = std::make_shared<UserAttrCacheItem>(*this, nullptr, kCacheFetchNewPending);
     it = emplace(key, item).first;
@@ -398,21 +404,112 @@ void UserAttrCache::fetchAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheIte
 {
     if (!mIsLoggedIn && !(key.attrType & USER_ATTR_FLAG_COMPOSITE) && !mClient.anonymousMode())
         return;
-    switch (key.attrType)
-    {
-        case USER_ATTR_FULLNAME:
-            fetchUserFullName(key, item);
-            break;
-        case USER_ATTR_RSA_PUBKEY:
-            fetchRsaPubkey(key, item);
-            break;
-        case USER_ATTR_EMAIL:
-            fetchEmail(key, item);
-            break;
-        default:
-            fetchStandardAttr(key, item);
-            break;
+
+    if (key.attrType == USER_ATTR_FULLNAME)
+    {
+        // composed from first and last names, whose fetches are queued by themselves
+        fetchUserFullName(key, item);
+        return;
     }
+
+    mFetchQueue[key.attrType][key] = item;
+    if (mFetchQueueFlushPending)
+        return;
+
+    mFetchQueueFlushPending = true;
+    auto wptr = weakHandle();
+    marshallCall([wptr, this]()
+    {
+        if (wptr.deleted())
+            return;
+
+        flushFetchQueue();
+    }, mClient.appCtx);
+}
+
+void UserAttrCache::flushFetchQueue()
+{
+    mFetchQueueFlushPending = false;
+    if (!mIsLoggedIn && !mClient.anonymousMode())
+    {
+        // items are still pending, they will be fetched by onLogin()
+        mFetchQueue.clear();
+        return;
+    }
+
+    FetchQueue queue;
+    queue.swap(mFetchQueue);
+    mStats.batches++;
+
+    for (auto& group: queue)
+    {
+        uint8_t type = group.first;
+        if (type == USER_ATTR_EMAIL)
+        {
+            resolveEmailsLocally(group.second);
+        }
+
+        UACACHE_LOG_DEBUG("Fetching %s of %zu users", attrName(type), group.second.size());
+        for (auto& entry: group.second)
+        {
+            auto it = find(entry.first);
+            if (it == end() || it->second != entry.second || !entry.second->pending)
+                continue; // removed from the cache or resolved meanwhile
+
+            switch (type)
+            {
+                case USER_ATTR_RSA_PUBKEY:
+                    fetchRsaPubkey(entry.first, entry.second);
+                    break;
+                case USER_ATTR_EMAIL:
+                    fetchEmail(entry.first, entry.second);
+                    break;
+                default:
+                    fetchStandardAttr(entry.first, entry.second);
+                    break;
+            }
+        }
+    }
+
+    UACACHE_LOG_DEBUG("Fetch queue flushed: %u requests in flight, %s resolved locally, hit rate %.1f%%",
+                      mStats.inFlight, std::to_string(mStats.localHits).c_str(), mStats.hitRate());
+}
+
+void UserAttrCache::resolveEmailsLocally(FetchGroup& group)
+{
+    std::unique_ptr<::mega::MegaUserList> contacts(mClient.api.sdk.getContacts());
+    if (!contacts)
+        return;
+
+    for (int i = 0; i < contacts->size() && !group.empty(); i++)
+    {
+        ::mega::MegaUser* user = contacts->get(i);
+        const char* email = user->getEmail();
+        if (!email || !email[0])
+            continue;
+
+        auto it = group.find(UserAttrPair(user->getHandle(), USER_ATTR_EMAIL));
+        if (it == group.end())
+            continue;
+
+        UserAttrPair key = it->first;
+        std::shared_ptr<UserAttrCacheItem> item = it->second;
+        group.erase(it);
+
+        auto cacheIt = find(key);
+        if (cacheIt == end() || cacheIt->second != item || !item->pending)
+            continue;
+
+        mStats.localHits++;
+        item->data.reset(new Buffer(email, strlen(email)));
+        item->resolve(key);
+    }
+}
+
+double UserAttrCache::Stats::hitRate() const
+{
+    uint64_t total = hits + joined + misses;
+    return total ? ((hits + joined) * 100.0 / total) : 100.0;
 }
 void UserAttrCache::fetchStandardAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item)
 {
@@ -422,11 +519,13 @@ void UserAttrCache::fetchStandardAttr(UserAttrPair key, std::shared_ptr<UserAttr
     std::string auxPh = key.mPh.toString(Id::CHATLINKHANDLE);
     const char *ph = key.mPh.isValid() ? auxPh.c_str() : NULL;
 
+    mStats.inFlight++;
     mClient.api.call(&::mega::MegaApi::getChatUserAttribute,
         key.user.toString().c_str(), (int)key.attrType, ph)
     .then([wptr, this, key, item](ReqResult result)
     {
         wptr.throwIfDeleted();
+        mStats.inFlight--;
         auto& desc = gUserAttrDescsMap.at(key.attrType);
         item->data.reset(desc.getData(*result));
         item->resolve(key);
@@ -434,6 +533,7 @@ void UserAttrCache::fetchStandardAttr(UserAttrPair key, std::shared_ptr<UserAttr
     .fail([wptr, this, key, item](const ::promise::Error& err)
     {
         wptr.throwIfDeleted();
+        mStats.inFlight--;
         item->error(key, err.code());
         return err;
     });
@@ -442,11 +542,13 @@ void UserAttrCache::fetchStandardAttr(UserAttrPair key, std::shared_ptr<UserAttr
 void UserAttrCache::fetchEmail(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item)
 {
     auto wptr = weakHandle();
+    mStats.inFlight++;
     mClient.api.call(&::mega::MegaApi::getUserEmail,
         key.user.val)
     .then([wptr, this, key, item](ReqResult result)
     {
         wptr.throwIfDeleted();
+        mStats.inFlight--;
         auto email = result->getEmail();
         item->data.reset(new Buffer(email, strlen(email)));
         item->resolve(key);
@@ -454,6 +556,7 @@ void UserAttrCache::fetchEmail(UserAttrPair key, std::shared_ptr<UserAttrCacheIt
     .fail([wptr, this, key, item](const ::promise::Error& err)
     {
         wptr.throwIfDeleted();
+        mStats.inFlight--;
         item->error(key, err.code());
         return err;
     });
@@ -527,16 +630,19 @@ void UserAttrCache::fetchUserFullName(UserAttrPair key, std::shared_ptr<UserAttr
 void UserAttrCache::fetchRsaPubkey(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item)
 {
     auto wptr = weakHandle();
+    mStats.inFlight++;
     mClient.api.call(&::mega::MegaApi::getUserData, key.user.toString().c_str())
     .fail([wptr, this, key, item](const ::promise::Error& err)
     {
         wptr.throwIfDeleted();
+        mStats.inFlight--;
         item->error(key, err.code());
         return err;
     })
     .then([wptr, this, key, item](ReqResult result) -> ::promise::Promise<void>
     {
         wptr.throwIfDeleted();
+        mStats.inFlight--;
         auto rsakey = result->getPassword();
         size_t keylen;
         if (!rsakey || ((keylen = strlen(rsakey)) < 1))
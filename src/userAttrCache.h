@@ -127,13 +127,39 @@ struct UserAttrCacheItem
 class UserAttrCache: public std::map<UserAttrPair, std::shared_ptr<UserAttrCacheItem>>,
                      public ::mega::MegaGlobalListener, public karere::DeleteTrackable
 {
+public:
+    /** @brief Counters of the usage of the cache */
+    struct Stats
+    {
+        uint64_t hits = 0;      // requests served from the cache
+        uint64_t joined = 0;    // requests that joined a fetch already in progress
+        uint64_t misses = 0;    // requests that required a new fetch
+        uint64_t localHits = 0; // misses resolved from the SDK's local state, without any request
+        uint64_t batches = 0;   // flushes of the fetch queue
+        uint32_t inFlight = 0;  // backend requests in progress
+        /** Percentage of requests that didn't require a new fetch */
+        double hitRate() const;
+    };
+
 protected:
+    // pending fetches grouped by attribute type
+    typedef std::map<UserAttrPair, std::shared_ptr<UserAttrCacheItem>> FetchGroup;
+    typedef std::map<uint8_t, FetchGroup> FetchQueue;
+
     Client& mClient;
     bool mIsLoggedIn = false;
+    Stats mStats;
+    FetchQueue mFetchQueue;
+    bool mFetchQueueFlushPending = false;
     void dbWrite(UserAttrPair key, const Buffer& data);
     void dbWriteNull(UserAttrPair key);
     void dbInvalidateItem(UserAttrPair item);
+    /** @brief Queues the fetch of an attribute. The misses of the same event-loop
+     * iteration are fetched together by \c flushFetchQueue() */
     void fetchAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item);
+    void flushFetchQueue();
+    /** Resolves the emails of contacts known by the SDK and removes them from \c group */
+    void resolveEmailsLocally(FetchGroup& group);
 //actual attrib fetch backend functions
     void fetchUserFullName(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item);
     void fetchStandardAttr(UserAttrPair key, std::shared_ptr<UserAttrCacheItem>& item);
@@ -187,6 +213,7 @@ public:
      * request is currently registered (expired one-shot for example).
      */
     bool removeCb(Handle handle);
+    const Stats& stats() const { return mStats; }
 };
 
 }
@@ -0,0 +1,268 @@
+/**
+ * Query plan test for the statements of ChatdSqliteDb (src/chatdDb.h).
+ *
+ * Creates the current schema (src/dbSchema.sql, which is also the result of
+ * the migrations in karere::Client::openDb) in an in-memory db, extracts every
+ * SQL statement from chatdDb.h and runs EXPLAIN QUERY PLAN on it. Fails if a
+ * statement can't be prepared, or if it does a plain SCAN (without an index)
+ * of a table that grows with the history.
+ */
+
+#include <sqlite3.h>
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef KARERE_SRC_DIR
+#define KARERE_SRC_DIR "../../src"
+#endif
+
+// tables with a row per message, which must never be scanned
+static const std::set<std::string> kNoScanTables = { "history", "node_history", "chat_reactions" };
+
+// chatdDb.h builds some statements with the table name in a variable
+static const std::vector<std::string> kTableNames = { "history", "node_history" };
+
+static const char* kTablePlaceholder = "\x01";
+
+struct Token
+{
+    enum Type { kString, kIdent, kPunct } type;
+    std::string text;
+};
+
+static bool readFile(const std::string& path, std::string& out)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "Can't open " << path << std::endl;
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+// Minimal C++ lexer: string literals (unescaped), identifiers and punctuation. Comments are skipped
+static std::vector<Token> tokenize(const std::string& src)
+{
+    std::vector<Token> tokens;
+    size_t i = 0;
+    while (i < src.size())
+    {
+        char c = src[i];
+        if (isspace((unsigned char)c))
+        {
+            i++;
+        }
+        else if (src.compare(i, 2, "//") == 0 || c == '#')
+        {
+            i = src.find('\n', i);
+        }
+        else if (src.compare(i, 2, "/*") == 0)
+        {
+            i = src.find("*/", i + 2);
+            i = (i == std::string::npos) ? i : i + 2;
+        }
+        else if (c == '"' || c == '\'')
+        {
+            std::string text;
+            for (i++; i < src.size() && src[i] != c; i++)
+            {
+                if (src[i] == '\\')
+                    i++;
+                text += src[i];
+            }
+            i++;
+            if (c == '"')
+                tokens.push_back({Token::kString, text});
+        }
+        else if (isalnum((unsigned char)c) || c == '_')
+        {
+            size_t start = i;
+            while (i < src.size() && (isalnum((unsigned char)src[i]) || src[i] == '_'))
+                i++;
+            tokens.push_back({Token::kIdent, src.substr(start, i - start)});
+        }
+        else
+        {
+            tokens.push_back({Token::kPunct, std::string(1, c)});
+            i++;
+        }
+    }
+    return tokens;
+}
+
+static bool startsWithWord(const std::string& sql, const char* word)
+{
+    size_t len = strlen(word);
+    if (sql.size() <= len || !isspace((unsigned char)sql[len]))
+        return false;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (tolower((unsigned char)sql[i]) != word[i])
+            return false;
+    }
+    return true;
+}
+
+// Joins adjacent string literals, and literals concatenated with `+ variable +`
+// (replaced by kTablePlaceholder), and returns the ones that read tables
+static std::vector<std::string> extractQueries(const std::vector<Token>& tokens)
+{
+    std::vector<std::string> queries;
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+        if (tokens[i].text == "static_assert")
+        {
+            // skip its message, which may start with "update"
+            for (int depth = 0; ++i < tokens.size();)
+            {
+                depth += (tokens[i].text == "(") - (tokens[i].text == ")");
+                if (!depth)
+                    break;
+            }
+            continue;
+        }
+        if (tokens[i].type != Token::kString)
+            continue;
+
+        std::string sql = tokens[i].text;
+        size_t j = i + 1;
+        while (j < tokens.size())
+        {
+            if (tokens[j].type == Token::kString)
+            {
+                sql += tokens[j++].text;
+            }
+            else if (tokens[j].text == "+" && j + 1 < tokens.size() && tokens[j + 1].type == Token::kString)
+            {
+                sql += tokens[j + 1].text;
+                j += 2;
+            }
+            else if (tokens[j].text == "+" && j + 2 < tokens.size() && tokens[j + 1].type == Token::kIdent
+                     && tokens[j + 2].text == "+")
+            {
+                sql += kTablePlaceholder;
+                j += 2;
+            }
+            else
+            {
+                break;
+            }
+        }
+        i = j - 1;
+
+        while (!sql.empty() && isspace((unsigned char)sql[0]))
+            sql.erase(0, 1);
+
+        // plain inserts (values(...)) don't read any table
+        if (startsWithWord(sql, "select") || startsWithWord(sql, "update") || startsWithWord(sql, "delete"))
+        {
+            queries.push_back(sql);
+        }
+    }
+    return queries;
+}
+
+static std::vector<std::string> expandTableNames(const std::string& sql)
+{
+    size_t pos = sql.find(kTablePlaceholder);
+    if (pos == std::string::npos)
+        return { sql };
+
+    std::vector<std::string> result;
+    for (auto& table: kTableNames)
+    {
+        std::string expanded = sql;
+        expanded.replace(pos, 1, table);
+        for (auto& query: expandTableNames(expanded))
+            result.push_back(query);
+    }
+    return result;
+}
+
+// Returns the number of errors found in the query plan of \c sql
+static int checkQueryPlan(sqlite3* db, const std::string& sql)
+{
+    sqlite3_stmt* stmt;
+    std::string explain = "EXPLAIN QUERY PLAN " + sql;
+    if (sqlite3_prepare_v2(db, explain.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        std::cerr << "FAIL: can't prepare query (" << sqlite3_errmsg(db) << "):\n    " << sql << std::endl;
+        return 1;
+    }
+
+    int errors = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        // detail is "SCAN <table>..." (or "SCAN TABLE <table>..." in older versions)
+        std::string detail = (const char*)sqlite3_column_text(stmt, 3);
+        if (detail.compare(0, 5, "SCAN ") || detail.find(" USING ") != std::string::npos)
+            continue;
+
+        std::string table = detail.substr(5);
+        if (!table.compare(0, 6, "TABLE "))
+            table.erase(0, 6);
+        table = table.substr(0, table.find(' '));
+        if (kNoScanTables.count(table))
+        {
+            std::cerr << "FAIL: full table scan (" << detail << ") in query:\n    " << sql << std::endl;
+            errors++;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return errors;
+}
+
+int main(int argc, char** argv)
+{
+    std::string srcDir = (argc > 1) ? argv[1] : KARERE_SRC_DIR;
+    std::string schema, header;
+    if (!readFile(srcDir + "/dbSchema.sql", schema) || !readFile(srcDir + "/chatdDb.h", header))
+        return 1;
+
+    sqlite3* db;
+    if (sqlite3_open(":memory:", &db) != SQLITE_OK)
+    {
+        std::cerr << "Can't open in-memory db" << std::endl;
+        return 1;
+    }
+
+    char* err = nullptr;
+    if (sqlite3_exec(db, schema.c_str(), nullptr, nullptr, &err) != SQLITE_OK)
+    {
+        std::cerr << "Can't create the schema: " << err << std::endl;
+        sqlite3_free(err);
+        sqlite3_close(db);
+        return 1;
+    }
+
+    int count = 0;
+    int errors = 0;
+    for (auto& query: extractQueries(tokenize(header)))
+    {
+        for (auto& sql: expandTableNames(query))
+        {
+            errors += checkQueryPlan(db, sql);
+            count++;
+        }
+    }
+    sqlite3_close(db);
+
+    if (!count)
+    {
+        std::cerr << "FAIL: no queries found in chatdDb.h" << std::endl;
+        return 1;
+    }
+    std::cout << "Checked the query plan of " << count << " statements, " << errors << " errors" << std::endl;
+    return errors ? 1 : 0;
+}